@@ -34,9 +34,9 @@ set(compile_hwmodel
 set(run_hwmodel RRSBA_DIS_U=1 PSFD=1 DOITM=1)
 
 set(compile_swmodel
-  LLVMFLAGS -no-stack-slot-sharing -no-promote-arguments
+  LLVMFLAGS -no-stack-slot-sharing -no-promote-arguments -clou-inline-partial
   CFLAGS -fno-jump-tables -mno-red-zone
-  PASS DuplicatePass MemIntrinsicPass InlinePass Attributes
+  PASS DuplicatePass CASpecializePass MemIntrinsicPass InlinePass Attributes
 )
 set(run_swmodel)
 
@@ -46,12 +46,23 @@ set(compile_llsct_fence
 )
 set(run_llsct_fence)
 
+# Right-sized stacks keep -clou-fps-signal-slack bytes for signal handlers running on them.
 set(compile_llsct_fps
-  LLVMFLAGS -clou=+fps
+  LLVMFLAGS -clou=+fps -clou-fps-right-size
   PASS FunctionLocalStacks
 )
 set(run_llsct_fps)
 
+set(compile_llsct_fps_share
+  LLVMFLAGS -clou-fps-share
+)
+set(run_llsct_fps_share)
+
+set(compile_llsct_fps_tls
+  LLVMFLAGS -clou-fps-tls=initial-exec
+)
+set(run_llsct_fps_tls)
+
 set(compile_llsct_regclean
   LLVMFLAGS -clou=+prech
 )
@@ -79,6 +90,23 @@ set(compile_llsct_fallthru LLVMFLAGS -clou=+fallthru)
 set(run_llsct_fallthru)
 
 
+# The swmodel code generation flags without the LLSCT passes, plus CaptureIRPass: saves the IR the LLSCT passes would
+# see, for the compile-time benchmarks (see compile-bench.py).
+set(compile_capture
+  LLVMFLAGS -no-stack-slot-sharing -no-promote-arguments
+  CFLAGS -fno-jump-tables -mno-red-zone
+  PASS CaptureIRPass
+)
+
+# Counts executions of each mitigation in-process (see fences-main.cc). TracePass must come after the passes that insert
+# mitigations, so this key goes last.
+set(compile_trace
+  PASS TracePass
+  LDFLAGS -L$<TARGET_FILE_DIR:trace_runtime> -l$<TARGET_LINKER_FILE_BASE_NAME:trace_runtime> -lstdc++
+  DEPENDS trace_runtime
+)
+set(run_trace)
+
 # Ultimate SLH
 set(compile_uslh
   LLVMFLAGS --x86-speculative-load-hardening --x86-slh-fixed --x86-slh-indirect --x86-slh-ip --x86-slh-loads --x86-slh-sbhAll --x86-slh-vtInstr --x86-slh-post-load=0 --x86-slh-store
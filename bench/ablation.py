@@ -0,0 +1,93 @@
+# Breaks down the overhead of the LLSCT mitigation into its components, from the time benchmarks of the ablation modes
+# (see register_ablation_mode in CMakeLists.txt) and the `base` mode. Input files are named
+# time_<lib>_<name>_<arg>_<mode>.json.
+#
+# For each benchmark, the overhead over `base` (in % of its time) is split into
+#   model      ablate-none: the software and hardware models without any LLSCT mitigation;
+#   <c>        the increment of enabling component <c> after the components before it (ablate-upto-<c>, or
+#              ablate-only-<c> for the first component),
+# which are plotted as a stacked bar. The table also lists each component on its own over ablate-none
+# (ablate-only-<c>), and how much the cumulative total differs from the sum of the individual costs (interaction).
+
+import argparse
+import json
+import math
+import os
+from collections import defaultdict
+import matplotlib.pyplot as plt
+
+parser = argparse.ArgumentParser()
+parser.add_argument('json', nargs = '+')
+parser.add_argument('-o', dest = 'out')
+parser.add_argument('-a', dest = 'aggregate', default = 'mean', choices = ['mean', 'median'])
+parser.add_argument('--baseline', default = 'base')
+parser.add_argument('--components', default = 'ncal_xmit,ncal_glob,ncas_xmit,ncas_ctrl,fps,prech,fallthru',
+                    help = 'components in cumulative order (default: %(default)s)')
+args = parser.parse_args()
+components = args.components.split(',')
+
+# (lib, name, arg) -> mode -> cpu_time
+results = defaultdict(dict)
+for jsonpath in args.json:
+    benchtype, lib, name, arg, mode = os.path.basename(os.path.splitext(jsonpath)[0]).split('_', maxsplit = 4)
+    with open(jsonpath) as f:
+        for result in json.load(f)['benchmarks']:
+            if result['name'] == f'{lib}_{name}/{arg}_{args.aggregate}':
+                results[(lib, name, arg)][mode] = result['cpu_time']
+
+
+def cumulative_mode(i):
+    return f'ablate-only-{components[0]}' if i == 0 else f'ablate-upto-{components[i]}'
+
+
+# benchmark -> list of (segment, overhead %), in stacking order
+stacks = {}
+for benchmark in sorted(results):
+    modes = results[benchmark]
+    displayname = '_'.join(benchmark)
+    if args.baseline not in modes or 'ablate-none' not in modes:
+        print(f'warning: no {args.baseline} or ablate-none results for {displayname}')
+        continue
+    overhead = lambda mode: (modes[mode] - modes[args.baseline]) / modes[args.baseline] * 100 if mode in modes else math.nan
+
+    segments = [('model', overhead('ablate-none'))]
+    prev = overhead('ablate-none')
+    for i, component in enumerate(components):
+        total = overhead(cumulative_mode(i))
+        segments.append((component, total - prev))
+        prev = total
+    stacks[displayname] = segments
+
+    individual = {component: overhead(f'ablate-only-{component}') - overhead('ablate-none') for component in components}
+    interaction = prev - overhead('ablate-none') - sum(individual.values())
+    print(f'{displayname} (overhead over {args.baseline}, % of its {args.aggregate} time):')
+    print(f'  {"component":<12} {"cumulative":>10} {"individual":>10}')
+    for segment, increment in segments:
+        print(f'  {segment:<12} {increment:>10.1f} {individual.get(segment, increment):>10.1f}')
+    print(f'  {"total":<12} {prev:>10.1f}    (interaction {interaction:.1f})')
+
+if not stacks:
+    raise SystemExit('ablation.py: nothing to plot')
+
+# Mean of each segment over the benchmarks.
+names = list(stacks)
+stacks['mean'] = [(segment, sum(stacks[name][i][1] for name in names) / len(names))
+                  for i, (segment, _) in enumerate(stacks[names[0]])]
+
+fig, ax = plt.subplots(figsize = (max(6, len(stacks)), 4))
+labels = list(stacks)
+bottoms = [0] * len(labels)
+for i, (segment, _) in enumerate(stacks[labels[0]]):
+    heights = [0 if math.isnan(stacks[label][i][1]) else stacks[label][i][1] for label in labels]
+    ax.bar(labels, heights, bottom = bottoms, label = segment)
+    bottoms = [bottom + height for bottom, height in zip(bottoms, heights)]
+ax.set_ylabel(f'overhead over {args.baseline} (%)')
+ax.axhline(0, color = 'gray', linewidth = 0.5)
+ax.tick_params(axis = 'x', labelrotation = 45, labelsize = 'small')
+ax.legend(fontsize = 'small')
+
+fig.tight_layout()
+if args.out:
+    fig.savefig(args.out)
+else:
+    plt.show()
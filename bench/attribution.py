@@ -0,0 +1,186 @@
+# Overhead attribution: ranks the LFENCEs inserted by MitigatePass by the cycles they are estimated to cost per call.
+#
+# Joins, by mitigation site ("<function>: <src>---><dst> #<id>", where <id> is MitigatePass's per-function site ID, so
+# that fences with the same source locations stay apart),
+#   - the static per-function logs written with -clou-log (lfence_srclocs: site ID, source locations, the categories of
+#     the STs that forced the cut, and its static weight);
+#   - the dynamic executions per call of each site, from a fences_*.json file (fences-main.cc) or a clou_trace binary
+#     dump (CLOU_TRACE_FILE, see tools/trace_runtime.cc) together with the number of calls it covers;
+#   - the time delta per call between a baseline and the mitigated build, from two Google Benchmark JSON files.
+#
+# Each dynamic fence is charged the same cost: --fence-cycles if given, otherwise the time delta divided by the fences
+# executed per call. The delta also includes the mitigation's non-fence costs (the software and hardware models,
+# function-local stacks, register cleaning, ...); subtract them with --subtract, once per component, given the time
+# benchmarks of a build without and with that component alone, e.g. from the ablation modes (see
+# register_ablation_mode in CMakeLists.txt):
+#   --subtract base ablate-none --subtract ablate-none ablate-only-fps --subtract ablate-none ablate-only-prech
+# Otherwise the whole delta is spread over the fences. Times are converted to cycles with the CPU frequency from the
+# benchmark context, or --ghz.
+
+import argparse
+import collections
+import json
+import os
+import struct
+import sys
+
+parser = argparse.ArgumentParser()
+parser.add_argument('--logs', action = 'append', required = True, help = '-clou-log directory (repeatable)')
+dynamic = parser.add_mutually_exclusive_group(required = True)
+dynamic.add_argument('--fences', help = 'fences_*.json written by fences-main.cc')
+dynamic.add_argument('--trace', help = 'binary clou_trace dump')
+parser.add_argument('--calls', type = float, default = 1, help = 'calls covered by --trace (default 1)')
+parser.add_argument('--base', help = 'Google Benchmark JSON for the baseline')
+parser.add_argument('--mitigated', help = 'Google Benchmark JSON for the mitigated build')
+parser.add_argument('--subtract', nargs = 2, action = 'append', default = [], metavar = ('WITHOUT', 'WITH'),
+                    help = 'Google Benchmark JSONs of builds without and with a non-fence component, whose delta is '
+                    'subtracted from the time delta (repeatable)')
+parser.add_argument('--fence-cycles', type = float, help = 'cycles per executed fence, instead of the time delta')
+parser.add_argument('--ghz', type = float, help = 'CPU frequency (default: mhz_per_cpu from the benchmark context)')
+parser.add_argument('-n', dest = 'top', type = int, default = 30, help = 'rows to print (0 for all)')
+parser.add_argument('--json', dest = 'json_out', help = 'also write the full ranking as JSON')
+parser.add_argument('-o', dest = 'out')
+args = parser.parse_args()
+if args.fence_cycles is None and not (args.base and args.mitigated):
+    parser.error('either --fence-cycles or both --base and --mitigated are required')
+if args.subtract and not (args.base and args.mitigated):
+    parser.error('--subtract requires --base and --mitigated')
+
+
+def site_key(desc, site_id):
+    """Returns the site's key, as TracePass reports it."""
+    return desc if site_id is None or site_id < 0 else f'{desc} #{site_id}'
+
+
+def load_static(dirs):
+    """Returns the logged fences by site key: {key: {function, src, dst, weight, categories, count}}."""
+    sites = {}
+    for logdir in dirs:
+        for dirpath, _, filenames in os.walk(logdir):
+            for filename in filenames:
+                if not filename.endswith('.json'):
+                    continue
+                try:
+                    with open(os.path.join(dirpath, filename)) as f:
+                        log = json.load(f)
+                except (OSError, ValueError):
+                    continue
+                if not isinstance(log, dict):
+                    continue
+                for fence in log.get('lfence_srclocs', []):
+                    if 'desc' not in fence:
+                        sys.exit(f'{os.path.join(dirpath, filename)}: no fence descriptions; rebuild with a newer MitigatePass')
+                    # Logs without site IDs: fences on several edges between the same source locations share a key.
+                    site = sites.setdefault(site_key(fence['desc'], fence.get('id')), {
+                        'function': log.get('function_name', os.path.splitext(filename)[0]),
+                        'src': fence['src'], 'dst': fence['dst'], 'weight': 0, 'categories': set(), 'count': 0,
+                    })
+                    site['weight'] += fence.get('weight', 0)
+                    site['categories'].update(fence.get('categories', []))
+                    site['count'] += 1
+    return sites
+
+
+def load_dynamic():
+    """Returns executions per call by site key, and the total fences per call."""
+    per_call = collections.Counter()
+    if args.fences:
+        with open(args.fences) as f:
+            j = json.load(f)
+        for site in j['sites']:
+            per_call[site['desc']] += site['per_call']
+        return per_call, j['benchmarks'][0]['fences_per_call']
+    with open(args.trace, 'rb') as f:
+        data = f.read()
+    if data[:8] != b'CLOUTRC1':
+        sys.exit(f'{args.trace}: not a clou_trace dump')
+    (nsites,) = struct.unpack_from('=Q', data, 8)
+    offset = 16
+    for _ in range(nsites):
+        count, desclen = struct.unpack_from('=QI', data, offset)
+        offset += 12
+        per_call[data[offset:offset + desclen].decode()] += count / args.calls
+        offset += desclen
+    return per_call, sum(per_call.values())
+
+
+UNITS = {'ns': 1, 'us': 1e3, 'ms': 1e6, 's': 1e9}
+
+
+def load_cycles(path):
+    """Returns the cycles per call of the (median, if aggregated) run in a Google Benchmark JSON file."""
+    with open(path) as f:
+        j = json.load(f)
+    runs = [run for run in j['benchmarks'] if run.get('aggregate_name') == 'median'] or \
+        [run for run in j['benchmarks'] if run.get('run_type') != 'aggregate']
+    if not runs:
+        sys.exit(f'{path}: no benchmark runs')
+    run = runs[0]
+    if 'cycles' in run:
+        return run['cycles']
+    ghz = args.ghz or j['context'].get('mhz_per_cpu', 0) / 1e3
+    if not ghz:
+        sys.exit(f'{path}: no CPU frequency in the context; pass --ghz')
+    return run['cpu_time'] * UNITS[run.get('time_unit', 'ns')] * ghz
+
+
+static = load_static(args.logs)
+per_call, fences_per_call = load_dynamic()
+
+delta = None
+nonfence = 0
+if args.base and args.mitigated:
+    delta = load_cycles(args.mitigated) - load_cycles(args.base)
+    nonfence = sum(load_cycles(with_) - load_cycles(without) for without, with_ in args.subtract)
+if args.fence_cycles is not None:
+    fence_cycles = args.fence_cycles
+elif fences_per_call > 0:
+    fence_cycles = max(delta - nonfence, 0) / fences_per_call
+else:
+    fence_cycles = 0
+
+rows = []
+for desc, execs in per_call.items():
+    site = static.get(desc)
+    if site is None:
+        # Not in the logs (e.g. built without -clou-log); fall back to the description itself.
+        function, _, locs = desc.rpartition(': ')
+        locs, _, _ = locs.rpartition(' #') if ' #' in locs else (locs, '', '')
+        src, _, dst = locs.partition('--->')
+        site = {'function': function or '?', 'src': src, 'dst': dst, 'weight': None, 'categories': {'?'}, 'count': 0}
+    rows.append({'desc': desc, 'cycles': execs * fence_cycles, 'executions': execs, **site,
+                 'categories': sorted(site['categories'])})
+rows.sort(key = lambda row: (-row['cycles'], -row['executions'], row['desc']))
+executed = set(per_call)
+never_executed = sum(site['count'] for desc, site in static.items() if desc not in executed)
+
+by_category = collections.Counter()
+for row in rows:
+    for category in row['categories']:
+        by_category[category] += row['cycles']
+
+f = open(args.out, 'w') if args.out else sys.stdout
+if delta is not None:
+    print(f'time delta: {delta:.1f} cycles/call'
+          + (f', of which {nonfence:.1f} non-fence ({len(args.subtract)} components subtracted)' if args.subtract
+             else ' (non-fence costs not subtracted)'), file = f)
+print(f'fences: {fences_per_call:.1f} executed/call at {fence_cycles:.1f} cycles each'
+      + (f' (unattributed: {delta - nonfence - fences_per_call * fence_cycles:.1f} cycles/call)' if args.fence_cycles is not None and delta is not None else ''),
+      file = f)
+print(f'sites: {len(rows)} executed, {never_executed} logged but never executed', file = f)
+print('by category (a fence forced by several categories counts toward each): '
+      + ', '.join(f'{category} {cycles:.1f}' for category, cycles in by_category.most_common()), file = f)
+print(file = f)
+
+total = sum(row['cycles'] for row in rows)
+print(f'{"rank":>4} {"cycles":>10} {"%":>6} {"execs":>10}  {"categories":<24} {"function":<28} src ---> dst', file = f)
+for rank, row in enumerate(rows[:args.top or None], 1):
+    share = 100 * row['cycles'] / total if total else 0
+    print(f'{rank:>4} {row["cycles"]:>10.1f} {share:>6.2f} {row["executions"]:>10.2f}  {",".join(row["categories"]):<24} '
+          f'{row["function"]:<28} {row["src"]} ---> {row["dst"]}', file = f)
+
+if args.json_out:
+    with open(args.json_out, 'w') as jf:
+        json.dump({'delta_cycles': delta, 'nonfence_cycles': nonfence, 'fences_per_call': fences_per_call, 'fence_cycles': fence_cycles,
+                   'never_executed': never_executed, 'by_category': dict(by_category), 'sites': rows}, jf, indent = 2)
+        print(file = jf)
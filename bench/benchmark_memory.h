@@ -1,27 +1,65 @@
 #pragma once
 
 #include <cstddef>
+#include <cstdint>
 #include <cassert>
+#include <functional>
+#include <vector>
+#include <x86intrin.h>
 
 namespace benchmark {
 
   class State {
   public:
     State(size_t range_): range_(range_) {}
-    
-    const int *begin() const { return &dummy; }
-    const int *end() const { return &dummy + 1; }
+
+    /* Runs `iterations` iterations, appending the TSC to `timestamps` before the first and after every iteration,
+     * so that per-iteration latencies exclude the benchmark's setup (see sweep-main.cc).
+     */
+    State(size_t range_, size_t iterations, std::vector<uint64_t> *timestamps):
+      range_(range_), iterations(iterations), timestamps(timestamps) {}
+
+    /* Runs `iterations` iterations, calling `boundary(i)` before iteration i and, with i == iterations, after the last
+     * one, so that measurements can bracket each iteration without the benchmark's setup (see counters-main.cc).
+     */
+    State(size_t range_, size_t iterations, std::function<void(size_t)> boundary):
+      range_(range_), iterations(iterations), boundary(std::move(boundary)) {}
+
+    class Iterator {
+    public:
+      Iterator(State *state, size_t i): state(state), i(i) {}
+
+      int operator*() const { return 0; }
+      Iterator& operator++() { ++i; return *this; }
+      bool operator!=(const Iterator& other) const {
+	if (state->timestamps) {
+	  _mm_lfence();
+	  state->timestamps->push_back(__rdtsc());
+	  _mm_lfence();
+	}
+	if (state->boundary)
+	  state->boundary(i);
+	return i != other.i;
+      }
+
+    private:
+      State *state;
+      size_t i;
+    };
+
+    Iterator begin() { return Iterator(this, 0); }
+    Iterator end() { return Iterator(this, iterations); }
 
     size_t range(unsigned dim) const {
       assert(dim == 0);
       return range_;
     }
 
-    
-
   private:
     size_t range_;
-    int dummy;
+    size_t iterations = 1;
+    std::vector<uint64_t> *timestamps = nullptr;
+    std::function<void(size_t)> boundary;
   };
-  
+
 }
@@ -0,0 +1,101 @@
+# Statistics shared by plot.py and compare.py: loading per-repetition samples from Google-Benchmark-style JSON, bootstrap
+# confidence intervals for the relative change between two builds, and the Mann-Whitney U test.
+
+import itertools
+import json
+import math
+from collections import defaultdict
+
+import numpy as np
+
+# The metric that each benchmark type is compared on by default, by the prefix of its JSON filenames.
+METRIC_KEYS = {
+    'time': 'cpu_time',
+    'counters': 'cycles',
+    'throughput': 'items_per_second',
+    'sweep': 'cycles',
+    'fences': 'fences_per_call',
+    'footprint': 'peak_rss_bytes',
+}
+
+
+def metric_key(metric):
+    return METRIC_KEYS.get(metric, metric)
+
+
+def higher_is_better(key):
+    return key.endswith('_per_second') or key.endswith('_per_cycle')
+
+
+def load_samples(path, key):
+    """Returns {run_name: [samples of key]} from a JSON file: one sample per repetition ("iteration" entries), or, for
+    files that only hold aggregates, the mean as a single sample."""
+    with open(path) as f:
+        runs = json.load(f)['benchmarks']
+    samples = defaultdict(list)
+    for run in runs:
+        if run.get('run_type', 'iteration') == 'iteration' and key in run and not run.get('error_occurred'):
+            samples[run.get('run_name', run['name'])].append(float(run[key]))
+    for run in runs:
+        name = run.get('run_name', run['name'].removesuffix('_mean'))
+        is_mean = run.get('aggregate_name') == 'mean' or (
+            'aggregate_name' not in run and run['name'].endswith('_mean'))
+        if is_mean and key in run and name not in samples:
+            samples[name] = [float(run[key])]
+    return dict(samples)
+
+
+def relative_change(base, cand):
+    """The change of the mean from base to cand, in % of the mean of base."""
+    base_mean = np.mean(base)
+    return 0. if base_mean == 0 else (np.mean(cand) - base_mean) / base_mean * 100
+
+
+def bootstrap_change(base, cand, resamples = 2000, confidence = 0.95, rng = None):
+    """Returns the relative change from base to cand (see relative_change), its percentile bootstrap confidence
+    interval (lo, hi), and the bootstrap replicates, resampling base and cand independently."""
+    rng = rng if rng is not None else np.random.default_rng(0)
+    base = np.asarray(base, dtype = float)
+    cand = np.asarray(cand, dtype = float)
+    base_means = rng.choice(base, size = (resamples, len(base))).mean(axis = 1)
+    cand_means = rng.choice(cand, size = (resamples, len(cand))).mean(axis = 1)
+    with np.errstate(divide = 'ignore', invalid = 'ignore'):
+        replicates = np.where(base_means == 0, 0., (cand_means - base_means) / base_means * 100)
+    alpha = (1 - confidence) / 2
+    lo, hi = np.quantile(replicates, [alpha, 1 - alpha])
+    return relative_change(base, cand), (float(lo), float(hi)), replicates
+
+
+def mann_whitney(a, b, exact_limit = 20000):
+    """Returns the two-sided p-value of the Mann-Whitney U test of a and b. Exact (by enumerating the rank assignments)
+    when there are at most exact_limit of them, and otherwise the normal approximation with tie and continuity
+    corrections."""
+    n1, n2 = len(a), len(b)
+    if n1 == 0 or n2 == 0:
+        return 1.
+    values = np.concatenate([np.asarray(a, dtype = float), np.asarray(b, dtype = float)])
+    # Midranks, so that ties share their average rank.
+    order = np.argsort(values, kind = 'mergesort')
+    ranks = np.empty(len(values))
+    sorted_values = values[order]
+    i = 0
+    while i < len(values):
+        j = i
+        while j + 1 < len(values) and sorted_values[j + 1] == sorted_values[i]:
+            j += 1
+        ranks[order[i:j + 1]] = (i + j) / 2 + 1
+        i = j + 1
+    u = ranks[:n1].sum() - n1 * (n1 + 1) / 2
+    mean_u = n1 * n2 / 2
+
+    if math.comb(n1 + n2, n1) <= exact_limit:
+        us = np.array([sum(ranks[list(c)]) - n1 * (n1 + 1) / 2 for c in itertools.combinations(range(n1 + n2), n1)])
+        return float(min(1., np.mean(np.abs(us - mean_u) >= abs(u - mean_u) - 1e-9)))
+
+    n = n1 + n2
+    _, tie_counts = np.unique(values, return_counts = True)
+    var_u = n1 * n2 / 12 * ((n + 1) - np.sum(tie_counts ** 3 - tie_counts) / (n * (n - 1)))
+    if var_u == 0:
+        return 1.
+    z = (abs(u - mean_u) - 0.5) / math.sqrt(var_u)
+    return float(min(1., math.erfc(max(z, 0) / math.sqrt(2))))
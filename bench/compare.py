@@ -0,0 +1,134 @@
+# Compares benchmark results of a baseline and a candidate build, and gates on regressions. Takes the JSON files (or
+# directories of them) written by the benchmarks, named <metric>_<lib>_<name>_<arg>_<mode>.json; files with the same
+# name (e.g. from several directories) are pooled as repeated runs. Files are paired by name, or, with
+# --modes BASE:CAND, by name up to the mode (e.g. to get the overhead of one mode over another within the same runs).
+#
+# For each benchmark (run name within a pair of files), compares the per-repetition samples of the metric (-k, or the
+# default for the file's metric, see benchstats.METRIC_KEYS): the relative change of the mean with a bootstrap
+# confidence interval, and the p-value of a Mann-Whitney U test. A benchmark regresses if its change is worse than
+# --threshold percent with the whole confidence interval beyond it, and the test is significant at --alpha; it
+# improves likewise in the other direction. Benchmarks with a single sample on either side are reported but never
+# flagged.
+#
+# Prints a table, writes the verdict as JSON to -o, and exits with status 1 if anything regressed.
+
+import argparse
+import json
+import os
+import sys
+
+import numpy as np
+
+import benchstats
+
+parser = argparse.ArgumentParser()
+parser.add_argument('--baseline', action = 'extend', nargs = '+', required = True, help = 'JSON files or directories')
+parser.add_argument('--candidate', action = 'extend', nargs = '+', required = True, help = 'JSON files or directories')
+parser.add_argument('--modes', help = 'BASE:CAND: pair files whose names differ only in the mode')
+parser.add_argument('-k', dest = 'key', help = 'JSON key of the metric to compare (default: inferred from the filenames)')
+parser.add_argument('--threshold', type = float, default = 5, help = 'regression threshold, in %% (default: %(default)s)')
+parser.add_argument('--alpha', type = float, default = 0.05, help = 'significance level (default: %(default)s)')
+parser.add_argument('--confidence', type = float, default = 0.95, help = 'confidence level (default: %(default)s)')
+parser.add_argument('--resamples', type = int, default = 2000, help = 'bootstrap resamples (default: %(default)s)')
+parser.add_argument('--seed', type = int, default = 0)
+parser.add_argument('--no-fail', action = 'store_true', help = 'exit with status 0 even if something regressed')
+parser.add_argument('-o', dest = 'out', help = 'write the verdict as JSON')
+args = parser.parse_args()
+
+
+def find_jsons(paths):
+    jsons = []
+    for path in paths:
+        if os.path.isdir(path):
+            jsons += [os.path.join(path, name) for name in sorted(os.listdir(path)) if name.endswith('.json')]
+        else:
+            jsons.append(path)
+    return jsons
+
+
+def pair_key(path, mode):
+    """Returns the key that pairs path with its counterpart, or None if it isn't of the given mode."""
+    base = os.path.basename(os.path.splitext(path)[0])
+    if mode is None:
+        return base
+    parts = base.split('_', maxsplit = 4)
+    if len(parts) != 5 or parts[4] != mode:
+        return None
+    return '_'.join(parts[:4])
+
+
+def load(paths, mode):
+    """Returns {pair key: {run name: samples}}, pooling the samples of files with the same key."""
+    results = {}
+    for path in find_jsons(paths):
+        key = pair_key(path, mode)
+        if key is None:
+            continue
+        metric = key.split('_', maxsplit = 1)[0]
+        try:
+            samples = benchstats.load_samples(path, args.key or benchstats.metric_key(metric))
+        except (OSError, ValueError, KeyError) as e:
+            print(f'warning: {path}: {e}', file = sys.stderr)
+            continue
+        for run, values in samples.items():
+            results.setdefault(key, {}).setdefault(run, []).extend(values)
+    return results
+
+
+base_mode, cand_mode = args.modes.split(':') if args.modes else (None, None)
+baseline = load(args.baseline, base_mode)
+candidate = load(args.candidate, cand_mode)
+rng = np.random.default_rng(args.seed)
+
+rows = []
+for key in sorted(baseline.keys() & candidate.keys()):
+    metric = key.split('_', maxsplit = 1)[0]
+    metric_key = args.key or benchstats.metric_key(metric)
+    sign = -1 if benchstats.higher_is_better(metric_key) else 1
+    for run in sorted(baseline[key].keys() & candidate[key].keys()):
+        base, cand = baseline[key][run], candidate[key][run]
+        change, (lo, hi), _ = benchstats.bootstrap_change(base, cand, args.resamples, args.confidence, rng)
+        p = benchstats.mann_whitney(base, cand)
+        # Worse is positive, whichever direction the metric goes.
+        worse_lo, worse_hi = sorted((sign * lo, sign * hi))
+        if len(base) < 2 or len(cand) < 2:
+            verdict = 'insufficient'
+        elif p < args.alpha and worse_lo > args.threshold:
+            verdict = 'regression'
+        elif p < args.alpha and worse_hi < -args.threshold:
+            verdict = 'improvement'
+        elif p < args.alpha:
+            verdict = 'within-threshold'
+        else:
+            verdict = 'unchanged'
+        rows.append({'file': key, 'benchmark': run, 'key': metric_key, 'baseline_mean': float(np.mean(base)),
+                     'candidate_mean': float(np.mean(cand)), 'baseline_samples': len(base),
+                     'candidate_samples': len(cand), 'change': change, 'ci': [lo, hi], 'p_value': p,
+                     'verdict': verdict})
+
+unpaired = sorted(baseline.keys() ^ candidate.keys())
+for key in unpaired:
+    print(f'warning: {key}: only in the {"baseline" if key in baseline else "candidate"}', file = sys.stderr)
+if not rows:
+    sys.exit('compare.py: no benchmarks in common')
+
+print(f'{"benchmark":<48} {"key":<16} {"baseline":>14} {"candidate":>14} {"change":>8} '
+      f'{f"{args.confidence:.0%} CI":>18} {"p":>7}  verdict')
+for row in rows:
+    ci = f'[{row["ci"][0]:+.1f}, {row["ci"][1]:+.1f}]'
+    print(f'{row["file"] + ":" + row["benchmark"]:<48} {row["key"]:<16} {row["baseline_mean"]:>14.1f} '
+          f'{row["candidate_mean"]:>14.1f} {row["change"]:>+7.1f}% {ci:>18} {row["p_value"]:>7.4f}  {row["verdict"]}')
+
+regressions = [row for row in rows if row['verdict'] == 'regression']
+print(f'{len(regressions)} regressions, {sum(row["verdict"] == "improvement" for row in rows)} improvements in '
+      f'{len(rows)} benchmarks (threshold {args.threshold:g}%, alpha {args.alpha:g})')
+
+if args.out:
+    with open(args.out, 'w') as f:
+        json.dump({'verdict': 'fail' if regressions else 'pass', 'threshold': args.threshold, 'alpha': args.alpha,
+                   'confidence': args.confidence, 'regressions': len(regressions), 'benchmarks': rows,
+                   'unpaired': unpaired}, f, indent = 2)
+        print(file = f)
+
+if regressions and not args.no_fail:
+    sys.exit(1)
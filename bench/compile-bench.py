@@ -0,0 +1,178 @@
+# Compile-time benchmark for the LLSCT passes themselves. Replays captured IR (*.bc files written by
+# -llsct-capture-ir-dir, see src/CaptureIRPass.cc) through opt with each pass suite below, and writes
+# Google-Benchmark-style JSON with one entry per
+#   <suite>                           total over the corpus;
+#   <suite>/pass:<pass>               per pass, over the corpus;
+#   <suite>/<module>                  per module, with its peak RSS;
+#   <suite>/<module>/pass:<pass>      per pass and module;
+#   <suite>/<module>/fn:<function>    per function,
+# so that runs from different commits can be compared entry by entry. Times are wall-clock milliseconds (median of
+# -r runs), taken from opt's -time-trace. Pass times are inclusive: a module pass includes the function analyses it
+# runs on the fly. Per-function times cover the function passes only (module passes such as InlinePass and
+# FunctionLocalStacks are attributed to the module). Peak RSS is the opt process's maximum resident set size, in KiB.
+
+import argparse
+import collections
+import concurrent.futures
+import json
+import os
+import platform
+import signal
+import statistics
+import subprocess
+import sys
+import tempfile
+import threading
+import time
+
+SUITES = {
+    'analyses': ['-clou-nonspeculative-taint-analysis', '-clou-speculative-taint', '-clou-leak-analysis',
+                 '-constant-address-analysis'],
+    'InlinePass': ['-clou-inline-hints'],
+    'MitigatePass': ['-clou-mitigate'],
+    # MitigatePass without the exact min-cut refinement: the difference to MitigatePass is the time spent in Z3.
+    'MitigatePass-greedy': ['-clou-mitigate', '-clou-min-cut-exact-threshold=0'],
+    'FunctionLocalStacks': ['-clou-function-local-stacks'],
+    # The passes of the llsct mode, in the order clang runs them.
+    'llsct': ['-llsct-duplicate-pass', '-llsct-ca-specialize', '-llsct-mem-intrinsic-pass', '-clou-inline-hints',
+              '-clou-attributes-pass', '-clou-mitigate', '-clou-function-local-stacks'],
+}
+
+parser = argparse.ArgumentParser()
+parser.add_argument('corpus', nargs = '+', help = 'bitcode files, or directories to search for *.bc')
+parser.add_argument('--opt', default = 'opt')
+parser.add_argument('--load', action = 'append', default = [], help = 'pass plugin to load (repeatable)')
+parser.add_argument('--suite', action = 'append', choices = SUITES.keys(), help = 'suite to run (default: all)')
+parser.add_argument('--flag', dest = 'flags', action = 'append', default = [],
+                    help = 'opt flag for all suites (repeatable; pass as --flag=-x). CMake passes the LLVMFLAGS of the '
+                    'llsct mode\'s keys (see compile_bench_flags in CMakeLists.txt)')
+parser.add_argument('-r', dest = 'repetitions', type = int, default = 3)
+parser.add_argument('-j', dest = 'jobs', type = int, default = 1,
+                    help = 'modules to compile concurrently (more than 1 perturbs the timings)')
+parser.add_argument('--timeout', type = float, default = 600, help = 'seconds per opt run')
+parser.add_argument('-o', dest = 'out')
+args = parser.parse_args()
+
+
+def find_modules(paths):
+    """Returns (name, path) for each bitcode file, named relative to the corpus directory it was found in."""
+    modules = []
+    for path in paths:
+        if os.path.isdir(path):
+            root = os.path.dirname(os.path.normpath(path))
+            for dirpath, _, filenames in os.walk(path):
+                for filename in filenames:
+                    if filename.endswith('.bc'):
+                        full = os.path.join(dirpath, filename)
+                        modules.append((os.path.relpath(full, root), full))
+        else:
+            modules.append((os.path.basename(path), path))
+    return sorted(modules)
+
+
+def run_opt(cmd, stderr):
+    """Runs cmd, returning (exit status or None on timeout, wall time in ms, peak RSS in KiB)."""
+    start = time.perf_counter()
+    p = subprocess.Popen(cmd, stdout = subprocess.DEVNULL, stderr = stderr)
+    timer = threading.Timer(args.timeout, p.kill)
+    timer.start()
+    _, status, rusage = os.wait4(p.pid, 0)
+    timer.cancel()
+    stop = time.perf_counter()
+    p.returncode = os.waitstatus_to_exitcode(status)
+    timed_out = os.WIFSIGNALED(status) and os.WTERMSIG(status) == signal.SIGKILL
+    return None if timed_out else p.returncode, (stop - start) * 1e3, rusage.ru_maxrss
+
+
+def parse_trace(path):
+    """Returns inclusive times in ms by pass, and by function, from a -time-trace file."""
+    with open(path) as f:
+        events = [e for e in json.load(f)['traceEvents'] if e.get('ph') == 'X' and e['name'] in ('RunPass', 'OptFunction')]
+    events.sort(key = lambda e: (e['ts'], -e['dur']))
+    passes = collections.Counter()
+    functions = collections.Counter()
+    stack = []
+    for e in events:
+        while stack and stack[-1]['ts'] + stack[-1]['dur'] <= e['ts']:
+            stack.pop()
+        detail = e['args']['detail']
+        # Don't count a pass or function twice when it is nested in itself (e.g. analyses run on the fly).
+        if not any(outer['name'] == e['name'] and (e['name'] == 'OptFunction' or outer['args']['detail'] == detail)
+                   for outer in stack):
+            (passes if e['name'] == 'RunPass' else functions)[detail] += e['dur'] / 1e3
+        stack.append(e)
+    return passes, functions
+
+
+def measure(suite, name, path):
+    with tempfile.TemporaryDirectory(prefix = 'compile-bench.') as tmp:
+        cmd = [args.opt, '-enable-new-pm=0']
+        for lib in args.load:
+            cmd += ['-load', lib]
+        trace = os.path.join(tmp, 'trace.json')
+        cmd += SUITES[suite] + args.flags + [f'-clou-log={tmp}', '-time-trace', '-time-trace-granularity=0',
+                                               f'-time-trace-file={trace}', '-disable-output', path]
+        times, rss, passes, functions = [], 0, [], []
+        for _ in range(args.repetitions):
+            with open(os.path.join(tmp, 'stderr'), 'w+') as stderr:
+                status, ms, kib = run_opt(cmd, stderr)
+                if status != 0:
+                    stderr.seek(0)
+                    tail = stderr.read()[-2000:]
+                    reason = f'timed out after {args.timeout:g}s' if status is None else f'exited with status {status}'
+                    return {'error': f'{reason}: {tail}'}
+            times.append(ms)
+            rss = max(rss, kib)
+            p, f = parse_trace(trace)
+            passes.append(p)
+            functions.append(f)
+    median = lambda runs: {key: statistics.median(run[key] for run in runs) for key in set().union(*runs)}
+    return {'time': statistics.median(times), 'rss': rss, 'passes': median(passes), 'functions': median(functions)}
+
+
+def entry(name, ms, **counters):
+    return {'name': name, 'run_name': name, 'run_type': 'iteration', 'repetitions': args.repetitions,
+            'iterations': 1, 'real_time': ms, 'cpu_time': ms, 'time_unit': 'ms', **counters}
+
+
+modules = find_modules(args.corpus)
+if not modules:
+    sys.exit('compile-bench.py: no bitcode found in corpus')
+suites = args.suite or list(SUITES)
+
+opt_version = subprocess.run([args.opt, '--version'], capture_output = True, text = True).stdout.strip()
+context = {'date': time.strftime('%Y-%m-%dT%H:%M:%S%z'), 'host_name': platform.node(), 'executable': args.opt,
+           'opt_version': opt_version, 'flags': args.flags, 'modules': len(modules), 'repetitions': args.repetitions,
+           'jobs': args.jobs}
+
+benchmarks = []
+for suite in suites:
+    with concurrent.futures.ThreadPoolExecutor(max_workers = args.jobs) as pool:
+        results = list(pool.map(lambda module: measure(suite, *module), modules))
+
+    total_time, total_rss, total_passes, failures = 0, 0, collections.Counter(), 0
+    module_entries = []
+    for (name, _), result in zip(modules, results):
+        if 'error' in result:
+            print(f'{suite}/{name}: {result["error"]}', file = sys.stderr)
+            module_entries.append({'name': f'{suite}/{name}', 'run_name': f'{suite}/{name}', 'run_type': 'iteration',
+                                   'error_occurred': True, 'error_message': result['error']})
+            failures += 1
+            continue
+        total_time += result['time']
+        total_rss = max(total_rss, result['rss'])
+        total_passes.update(result['passes'])
+        module_entries.append(entry(f'{suite}/{name}', result['time'], peak_rss_kib = result['rss'],
+                                    functions = len(result['functions'])))
+        module_entries += [entry(f'{suite}/{name}/pass:{p}', ms) for p, ms in sorted(result['passes'].items())]
+        module_entries += [entry(f'{suite}/{name}/fn:{fn}', ms) for fn, ms in sorted(result['functions'].items())]
+
+    benchmarks.append(entry(suite, total_time, peak_rss_kib = total_rss, modules = len(modules), failures = failures))
+    benchmarks += [entry(f'{suite}/pass:{p}', ms) for p, ms in sorted(total_passes.items())]
+    benchmarks += module_entries
+    print(f'{suite}: {total_time / 1e3:.2f}s over {len(modules) - failures} modules, peak RSS {total_rss / 1024:.0f} MiB'
+          + (f', {failures} failed' if failures else ''), file = sys.stderr)
+
+f = open(args.out, 'w') if args.out else sys.stdout
+json.dump({'context': context, 'benchmarks': benchmarks}, f, indent = 2)
+print(file = f)
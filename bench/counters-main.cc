@@ -0,0 +1,293 @@
+// Unified hardware-counter driver: measures cycles, instructions, cache misses, backend stalls, and any raw events
+// listed in $PERF (comma-separated hex configs, e.g. PERF=r02A2,r01C2 or PERF=2a2) as one perf event group, together
+// with wall-clock time.
+//
+// Runs --benchmark_min_warmup_reps (default 10) untimed iterations followed by --benchmark_repetitions (default 100)
+// measured iterations of the benchmark loop, each counted separately, and writes Google-Benchmark-style JSON with one entry per repetition and one per
+// aggregate (mean, median, stddev, min, max, p90, p99), each holding every counter. Events that cannot be opened are
+// dropped with a warning, as are events (the raw ones first) while the group cannot be scheduled; if no perf events are
+// available at all (e.g. in a VM or with perf_event_paranoid > 2), or the group stops being scheduled, only wall-clock
+// time is reported.
+// The group is enabled only around each iteration (see benchmark::State in benchmark_memory.h), so the benchmark's
+// setup, e.g. allocating and filling its input, is not counted.
+// Set COLD=1 to evict the caches before each measured iteration.
+
+#include <algorithm>
+#include <cerrno>
+#include <cinttypes>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <functional>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include <err.h>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "shared.h"
+#include "shared-main.h"
+
+#define STR(x) #x
+#define XSTR(x) STR(x)
+
+namespace {
+
+  struct Event {
+    std::string name;
+    uint32_t type;
+    uint64_t config;
+    int fd = -1;
+  };
+
+  std::vector<Event> get_events() {
+    std::vector<Event> events = {
+      {"cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+      {"instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+      {"cache_misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+      {"stalled_cycles_backend", PERF_TYPE_HARDWARE, PERF_COUNT_HW_STALLED_CYCLES_BACKEND},
+    };
+    if (const char *s = std::getenv("PERF")) {
+      std::string list(s);
+      size_t pos = 0;
+      while (pos <= list.size()) {
+	const size_t end = std::min(list.find(',', pos), list.size());
+	std::string raw = list.substr(pos, end - pos);
+	pos = end + 1;
+	if (raw.empty())
+	  continue;
+	const char *hex = raw.c_str() + (raw[0] == 'r' || raw[0] == 'R' ? 1 : 0);
+	char *endp;
+	const uint64_t config = std::strtoull(hex, &endp, 16);
+	if (*hex == '\0' || *endp != '\0')
+	  errx(EXIT_FAILURE, "PERF: bad raw event: %s", raw.c_str());
+	events.push_back({"r" + std::string(hex), PERF_TYPE_RAW, config});
+      }
+    }
+    return events;
+  }
+
+  /* Opens the events as one group led by the first event that can be opened. Returns the events that were opened. */
+  std::vector<Event> open_group(std::vector<Event> events) {
+    std::vector<Event> opened;
+    int leader = -1;
+    for (Event& event : events) {
+      struct perf_event_attr pea;
+      std::memset(&pea, 0, sizeof pea);
+      pea.type = event.type;
+      pea.config = event.config;
+      pea.size = sizeof pea;
+      pea.disabled = leader < 0;
+      pea.exclude_kernel = 1;
+      pea.exclude_hv = 1;
+      pea.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+      event.fd = syscall(SYS_perf_event_open, &pea, 0, -1, leader, 0);
+      if (event.fd < 0) {
+	warn("perf_event_open: %s: dropping event", event.name.c_str());
+	continue;
+      }
+      if (leader < 0)
+	leader = event.fd;
+      opened.push_back(event);
+    }
+    if (opened.empty())
+      warnx("no perf events available; reporting wall-clock time only");
+    return opened;
+  }
+
+  void ioctl_group(const std::vector<Event>& events, unsigned long request) {
+    if (!events.empty() && ioctl(events.front().fd, request, PERF_IOC_FLAG_GROUP) < 0)
+      err(EXIT_FAILURE, "ioctl");
+  }
+
+  /* Reads the group's counts, scaled for multiplexing, or std::nullopt if the group was never scheduled. */
+  std::optional<std::vector<double>> read_group(const std::vector<Event>& events) {
+    if (events.empty())
+      return std::vector<double>();
+    std::vector<uint64_t> buf(3 + events.size());
+    const ssize_t bytes = read(events.front().fd, buf.data(), buf.size() * sizeof buf[0]);
+    if (bytes < 0)
+      err(EXIT_FAILURE, "read");
+    if (static_cast<size_t>(bytes) != buf.size() * sizeof buf[0] || buf[0] != events.size())
+      errx(EXIT_FAILURE, "read: unexpected perf group format");
+    const uint64_t enabled = buf[1];
+    const uint64_t running = buf[2];
+    if (running == 0)
+      return std::nullopt;
+    std::vector<double> counts(events.size());
+    for (size_t i = 0; i < events.size(); ++i)
+      counts[i] = static_cast<double>(buf[3 + i]) * enabled / running;
+    return counts;
+  }
+
+  void close_group(std::vector<Event>& events) {
+    for (Event& event : events)
+      close(event.fd);
+    events.clear();
+  }
+
+  /* Opens the events as one group (see open_group), dropping events from the end (the raw $PERF ones first) while
+   * the group cannot be scheduled at all, e.g. because it needs more counters than the CPU has.
+   */
+  std::vector<Event> open_schedulable_group(std::vector<Event> events) {
+    while (true) {
+      std::vector<Event> opened = open_group(events);
+      if (opened.empty())
+	return opened;
+      ioctl_group(opened, PERF_EVENT_IOC_RESET);
+      ioctl_group(opened, PERF_EVENT_IOC_ENABLE);
+      for (unsigned i = 0; i < 100000; ++i)
+	asm volatile ("");
+      ioctl_group(opened, PERF_EVENT_IOC_DISABLE);
+      if (read_group(opened))
+	return opened;
+      warnx("perf event group cannot be scheduled; dropping event %s", opened.back().name.c_str());
+      events.assign(opened.begin(), opened.end() - 1);
+      for (Event& event : events)
+	event.fd = -1;
+      close_group(opened);
+    }
+  }
+
+  double now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+  }
+
+  void clear_cache() {
+    std::vector<uint8_t> x(1024 * 1024 * 32); // 32 MB
+    std::fill(x.begin(), x.end(), 0x42);
+    asm volatile ("" :: "r"(x.data()) : "memory");
+  }
+
+  double percentile(std::vector<double> v, double p) {
+    std::sort(v.begin(), v.end());
+    const double rank = p / 100 * (v.size() - 1);
+    const size_t lo = std::floor(rank);
+    const size_t hi = std::ceil(rank);
+    return v[lo] + (v[hi] - v[lo]) * (rank - lo);
+  }
+
+  double mean(const std::vector<double>& v) {
+    double sum = 0;
+    for (double x : v)
+      sum += x;
+    return sum / v.size();
+  }
+
+  double stddev(const std::vector<double>& v) {
+    if (v.size() < 2)
+      return 0;
+    const double m = mean(v);
+    double sum = 0;
+    for (double x : v)
+      sum += (x - m) * (x - m);
+    return std::sqrt(sum / (v.size() - 1));
+  }
+
+}
+
+int main(int argc, char *argv[]) {
+  FILE *f = stdout;
+  unsigned warmup = 10;
+  unsigned repetitions = 100;
+  for (int i = 1; i < argc; ++i) {
+    const char *arg = argv[i];
+    std::vector<char> value(std::strlen(arg) + 1);
+    if (std::sscanf(arg, "--benchmark_out=%s", value.data()) == 1) {
+      if ((f = std::fopen(value.data(), "w")) == nullptr)
+	err(EXIT_FAILURE, "fopen: %s", value.data());
+    } else if (std::sscanf(arg, "--benchmark_repetitions=%u", &repetitions) == 1) {
+    } else if (std::sscanf(arg, "--benchmark_min_warmup_reps=%u", &warmup) == 1) {
+    }
+  }
+  if (repetitions == 0)
+    errx(EXIT_FAILURE, "--benchmark_repetitions must be positive");
+  const bool cold = std::getenv("COLD") && std::atoi(std::getenv("COLD")) != 0;
+
+  std::vector<Event> events = open_schedulable_group(get_events());
+
+  if (warmup > 0) {
+    benchmark::State state(BENCH_ARG, warmup, std::function<void(size_t)>());
+    SAFE_CALL(BENCH_NAME(state));
+  }
+
+  // samples[0] is wall-clock time; samples[1 + i] is events[i].
+  std::vector<std::vector<double>> samples(1 + events.size(), std::vector<double>(repetitions));
+  double start = 0;
+  // Stops the measurement of iteration rep - 1 (if any) and starts that of iteration rep (if any).
+  const auto boundary = [&] (size_t rep) {
+    if (rep > 0) {
+      const double stop = now_ns();
+      ioctl_group(events, PERF_EVENT_IOC_DISABLE);
+      samples[0][rep - 1] = stop - start;
+      if (const std::optional<std::vector<double>> counts = read_group(events)) {
+	for (size_t i = 0; i < counts->size(); ++i)
+	  samples[1 + i][rep - 1] = (*counts)[i];
+      } else {
+	warnx("perf event group was not scheduled during a repetition; reporting wall-clock time only");
+	close_group(events);
+	samples.resize(1);
+      }
+    }
+    if (rep < repetitions) {
+      if (cold)
+	clear_cache();
+      ioctl_group(events, PERF_EVENT_IOC_RESET);
+      ioctl_group(events, PERF_EVENT_IOC_ENABLE);
+      start = now_ns();
+    }
+  };
+  benchmark::State state(BENCH_ARG, repetitions, boundary);
+  SAFE_CALL(BENCH_NAME(state));
+
+  struct Aggregate {
+    const char *name;
+    double (*compute)(const std::vector<double>&);
+  };
+  static const Aggregate aggregates[] = {
+    {"mean", mean},
+    {"median", [] (const std::vector<double>& v) { return percentile(v, 50); }},
+    {"stddev", stddev},
+    {"min", [] (const std::vector<double>& v) { return percentile(v, 0); }},
+    {"max", [] (const std::vector<double>& v) { return percentile(v, 100); }},
+    {"p90", [] (const std::vector<double>& v) { return percentile(v, 90); }},
+    {"p99", [] (const std::vector<double>& v) { return percentile(v, 99); }},
+  };
+
+  const char *run_name = XSTR(BENCH_NAME) "/" XSTR(BENCH_ARG);
+  std::fprintf(f, "{\n  \"context\": {\n    \"executable\": \"%s\",\n    \"warmup_repetitions\": %u,\n    \"cold\": %s,\n"
+	       "    \"perf_events\": %s\n  },\n  \"benchmarks\": [", argv[0], warmup, cold ? "true" : "false",
+	       events.empty() ? "false" : "true");
+  for (unsigned rep = 0; rep < repetitions; ++rep) {
+    std::fprintf(f, "%s\n    {\n      \"name\": \"%s\",\n      \"run_name\": \"%s\",\n      \"run_type\": \"iteration\",\n"
+		 "      \"repetitions\": %u,\n      \"repetition_index\": %u,\n      \"iterations\": 1,\n"
+		 "      \"real_time\": %f,\n      \"cpu_time\": %f,\n      \"time_unit\": \"ns\"",
+		 rep == 0 ? "" : ",", run_name, run_name, repetitions, rep, samples[0][rep], samples[0][rep]);
+    for (size_t i = 0; i < events.size(); ++i)
+      std::fprintf(f, ",\n      \"%s\": %f", events[i].name.c_str(), samples[1 + i][rep]);
+    std::fprintf(f, "\n    }");
+  }
+  // Every aggregate follows at least one per-repetition entry (repetitions > 0), so each is preceded by a comma.
+  for (const Aggregate& agg : aggregates) {
+    const double time = agg.compute(samples[0]);
+    std::fprintf(f, "%s\n    {\n      \"name\": \"%s_%s\",\n      \"run_name\": \"%s\",\n      \"run_type\": \"aggregate\",\n"
+		 "      \"aggregate_name\": \"%s\",\n      \"repetitions\": %u,\n      \"iterations\": 1,\n"
+		 "      \"real_time\": %f,\n      \"cpu_time\": %f,\n      \"time_unit\": \"ns\"",
+		 ",", run_name, agg.name, run_name, agg.name, repetitions, time, time);
+    for (size_t i = 0; i < events.size(); ++i)
+      std::fprintf(f, ",\n      \"%s\": %f", events[i].name.c_str(), agg.compute(samples[1 + i]));
+    std::fprintf(f, "\n    }");
+  }
+  std::fprintf(f, "\n  ]\n}\n");
+  if (std::fclose(f) != 0)
+    err(EXIT_FAILURE, "fclose");
+}
@@ -0,0 +1,133 @@
+// Dynamic mitigation counts without Pin: for libraries built with TracePass (the "+trace" builds, see
+// register_trace_mode in CMakeLists.txt), reads the per-site execution counters of the trace runtime
+// (tools/trace_runtime.cc) around each call of BENCH_NAME, so counting runs at near-native speed.
+//
+// Runs --benchmark_min_warmup_reps (default 1) uncounted calls, then --benchmark_repetitions (default 10) counted
+// calls, and writes Google-Benchmark-style JSON with one entry holding the mitigations (LFENCEs) executed per call
+// (fences_per_call, and fences_min/fences_max over the calls), fences_per_byte, and the number of instrumented and
+// executed sites. A top-level "sites" array lists the executed sites by description (function and source locations of
+// the cut edge) and executions per call, most executed first.
+
+#include <algorithm>
+#include <cinttypes>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <err.h>
+
+#include "shared.h"
+#include "shared-main.h"
+
+#define STR(x) #x
+#define XSTR(x) STR(x)
+
+extern "C" {
+  uint64_t clou_trace_num_sites(void);
+  uint64_t clou_trace_read(uint64_t *counts, uint64_t n);
+  const char *clou_trace_site_desc(uint64_t site);
+  void clou_trace_quiet(void);
+}
+
+namespace {
+
+  std::vector<uint64_t> read_counts() {
+    std::vector<uint64_t> counts(clou_trace_num_sites());
+    counts.resize(std::min<uint64_t>(clou_trace_read(counts.data(), counts.size()), counts.size()));
+    return counts;
+  }
+
+  uint64_t sum(const std::vector<uint64_t>& counts) {
+    uint64_t total = 0;
+    for (uint64_t count : counts)
+      total += count;
+    return total;
+  }
+
+  void print_json_string(FILE *f, const char *s) {
+    std::fputc('"', f);
+    for (; *s; ++s) {
+      if (*s == '"' || *s == '\\')
+	std::fprintf(f, "\\%c", *s);
+      else if (static_cast<unsigned char>(*s) < 0x20)
+	std::fprintf(f, "\\u%04x", *s);
+      else
+	std::fputc(*s, f);
+    }
+    std::fputc('"', f);
+  }
+
+}
+
+int main(int argc, char *argv[]) {
+  FILE *f = stdout;
+  unsigned warmup = 1;
+  unsigned repetitions = 10;
+  for (int i = 1; i < argc; ++i) {
+    const char *arg = argv[i];
+    std::vector<char> value(std::strlen(arg) + 1);
+    if (std::sscanf(arg, "--benchmark_out=%s", value.data()) == 1) {
+      if ((f = std::fopen(value.data(), "w")) == nullptr)
+	err(EXIT_FAILURE, "fopen: %s", value.data());
+    } else if (std::sscanf(arg, "--benchmark_repetitions=%u", &repetitions) == 1) {
+    } else if (std::sscanf(arg, "--benchmark_min_warmup_reps=%u", &warmup) == 1) {
+    }
+  }
+  if (repetitions == 0)
+    errx(EXIT_FAILURE, "--benchmark_repetitions must be positive");
+
+  clou_trace_quiet();
+  if (clou_trace_num_sites() == 0)
+    warnx("no instrumented mitigation sites; was the library built with TracePass?");
+
+  benchmark::State state(BENCH_ARG);
+  for (unsigned i = 0; i < warmup; ++i)
+    SAFE_CALL(BENCH_NAME(state));
+
+  const std::vector<uint64_t> start = read_counts();
+  uint64_t prev = sum(start);
+  uint64_t min = UINT64_MAX, max = 0;
+  for (unsigned rep = 0; rep < repetitions; ++rep) {
+    SAFE_CALL(BENCH_NAME(state));
+    const uint64_t total = sum(read_counts());
+    min = std::min(min, total - prev);
+    max = std::max(max, total - prev);
+    prev = total;
+  }
+  const std::vector<uint64_t> stop = read_counts();
+
+  std::vector<std::pair<uint64_t, uint64_t>> executed; // (executions, site)
+  for (uint64_t site = 0; site < start.size(); ++site)
+    if (stop[site] > start[site])
+      executed.emplace_back(stop[site] - start[site], site);
+  std::sort(executed.begin(), executed.end(), [] (const auto& a, const auto& b) {
+    return a.first != b.first ? a.first > b.first : a.second < b.second;
+  });
+
+  const double per_call = static_cast<double>(sum(stop) - sum(start)) / repetitions;
+  const char *run_name = XSTR(BENCH_NAME) "/" XSTR(BENCH_ARG);
+  std::fprintf(f, "{\n  \"context\": {\n    \"executable\": \"%s\",\n    \"warmup_repetitions\": %u\n  },\n"
+	       "  \"benchmarks\": [\n    {\n      \"name\": \"%s\",\n      \"run_name\": \"%s\",\n"
+	       "      \"run_type\": \"iteration\",\n      \"repetitions\": %u,\n      \"iterations\": %u,\n"
+	       "      \"real_time\": 0,\n      \"cpu_time\": 0,\n      \"time_unit\": \"ns\",\n"
+	       "      \"fences_per_call\": %f,\n      \"fences_min\": %" PRIu64 ",\n      \"fences_max\": %" PRIu64 ",\n"
+	       "      \"fences_per_byte\": %f,\n      \"sites_instrumented\": %zu,\n      \"sites_executed\": %zu\n    }\n  ],\n"
+	       "  \"sites\": [", argv[0], warmup, run_name, run_name, repetitions, repetitions, per_call, min, max,
+	       per_call / BENCH_ARG, start.size(), executed.size());
+  for (size_t i = 0; i < executed.size(); ++i) {
+    const auto& [count, site] = executed[i];
+    std::fprintf(f, "%s\n    {\"desc\": ", i == 0 ? "" : ",");
+    print_json_string(f, clou_trace_site_desc(site));
+    std::fprintf(f, ", \"per_call\": %f}", static_cast<double>(count) / repetitions);
+  }
+  std::fprintf(f, "\n  ]\n}\n");
+  if (std::fclose(f) != 0)
+    err(EXIT_FAILURE, "fclose");
+
+  std::fprintf(stderr, "%s: %.1f fences per call (%.4f per byte) from %zu of %zu sites\n", run_name, per_call,
+	       per_call / BENCH_ARG, executed.size(), start.size());
+}
@@ -0,0 +1,229 @@
+// Memory footprint without ptrace or root: measures, in-process,
+//   - the static size of the library under test (libsodium.so or libhacl.so, or the executable itself for OpenSSL,
+//     which is linked statically), from its ELF section headers: code (.text and all other executable sections),
+//     read-only data, data, .bss (e.g., the function-local stacks and promoted frames of FunctionLocalStacks and
+//     FramePromotion), and thread-local storage;
+//   - the peak RSS during one call of BENCH_NAME (VmHWM from /proc/self/status, after resetting it through
+//     /proc/self/clear_refs; getrusage's ru_maxrss is reported too, but covers the whole process lifetime), and the
+//     resident set of the library's mappings (including the anonymous mapping of its .bss), the stack, and the heap
+//     after the call (from /proc/self/smaps).
+//
+// Writes Google-Benchmark-style JSON with one entry holding these as counters, in bytes.
+
+#include <cinttypes>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include <elf.h>
+#include <err.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <link.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "shared.h"
+#include "shared-main.h"
+
+#define STR(x) #x
+#define XSTR(x) STR(x)
+
+namespace {
+
+  struct SectionSizes {
+    uint64_t text = 0;
+    uint64_t code = 0;
+    uint64_t rodata = 0;
+    uint64_t data = 0;
+    uint64_t bss = 0;
+    uint64_t tls = 0;
+  };
+
+  std::string canonical_path(const char *path) {
+    char buf[PATH_MAX];
+    if (::realpath(path, buf) == nullptr)
+      err(EXIT_FAILURE, "realpath: %s", path);
+    return buf;
+  }
+
+  /* Returns whether base names the shared object lib<name>.so, or a versioned lib<name>.so.N... as loaded by its
+   * SONAME (e.g., libtool's libsodium.so.23). */
+  bool matches_library(const char *base, const char *prefix) {
+    const size_t len = std::strlen(prefix);
+    return std::strncmp(base, prefix, len) == 0 && (base[len] == '\0' || base[len] == '.');
+  }
+
+  /* Returns the path of the shared object for BENCH_LIB (libsodium.so, libhacl.so), or, for OpenSSL, which is linked
+   * statically, of the executable. */
+  std::string find_library() {
+    std::string path;
+    dl_iterate_phdr([] (struct dl_phdr_info *info, size_t, void *data) -> int {
+      const char *base = std::strrchr(info->dlpi_name, '/');
+      base = base ? base + 1 : info->dlpi_name;
+      if (!matches_library(base, BENCH_LIB ".so") && !matches_library(base, "lib" BENCH_LIB ".so"))
+	return 0;
+      *static_cast<std::string *>(data) = info->dlpi_name;
+      return 1;
+    }, &path);
+    if (path.empty()) {
+#ifdef BENCH_OPENSSL
+      path = "/proc/self/exe";
+#else
+      errx(EXIT_FAILURE, "%s: shared object not loaded", BENCH_LIB);
+#endif
+    }
+    return canonical_path(path.c_str());
+  }
+
+  SectionSizes get_section_sizes(const std::string& path) {
+    const int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+      err(EXIT_FAILURE, "open: %s", path.c_str());
+    struct stat st;
+    if (::fstat(fd, &st) < 0)
+      err(EXIT_FAILURE, "fstat: %s", path.c_str());
+    void *map = ::mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED)
+      err(EXIT_FAILURE, "mmap: %s", path.c_str());
+    ::close(fd);
+
+    const char *file = static_cast<const char *>(map);
+    const auto *ehdr = reinterpret_cast<const Elf64_Ehdr *>(file);
+    if (static_cast<size_t>(st.st_size) < sizeof *ehdr || std::memcmp(ehdr->e_ident, ELFMAG, SELFMAG) != 0 ||
+	ehdr->e_ident[EI_CLASS] != ELFCLASS64 || ehdr->e_shoff == 0)
+      errx(EXIT_FAILURE, "%s: not a 64-bit ELF file with section headers", path.c_str());
+    const auto *shdrs = reinterpret_cast<const Elf64_Shdr *>(file + ehdr->e_shoff);
+    const char *shstrtab = file + shdrs[ehdr->e_shstrndx].sh_offset;
+
+    SectionSizes sizes;
+    for (unsigned i = 0; i < ehdr->e_shnum; ++i) {
+      const Elf64_Shdr& shdr = shdrs[i];
+      const char *name = shstrtab + shdr.sh_name;
+      if (!(shdr.sh_flags & SHF_ALLOC))
+	continue;
+      if (shdr.sh_flags & SHF_TLS)
+	sizes.tls += shdr.sh_size;
+      else if (shdr.sh_flags & SHF_EXECINSTR)
+	sizes.code += shdr.sh_size;
+      else if (shdr.sh_type == SHT_NOBITS)
+	sizes.bss += shdr.sh_size;
+      else if (shdr.sh_flags & SHF_WRITE)
+	sizes.data += shdr.sh_size;
+      else if (std::strncmp(name, ".rodata", 7) == 0)
+	sizes.rodata += shdr.sh_size;
+      if (std::strcmp(name, ".text") == 0)
+	sizes.text += shdr.sh_size;
+    }
+
+    ::munmap(map, st.st_size);
+    return sizes;
+  }
+
+  /* Returns the value of a "<key>: <n> kB" line of /proc/self/status, in bytes. */
+  uint64_t read_status(const char *key) {
+    std::ifstream is("/proc/self/status");
+    std::string line;
+    while (std::getline(is, line)) {
+      uint64_t kb;
+      if (line.starts_with(key) && line[std::strlen(key)] == ':' &&
+	  std::sscanf(line.c_str() + std::strlen(key) + 1, "%" SCNu64 " kB", &kb) == 1)
+	return kb * 1024;
+    }
+    errx(EXIT_FAILURE, "/proc/self/status: no %s", key);
+  }
+
+  /* Resets VmHWM to the current RSS (Linux 4.0 and later). */
+  bool reset_peak_rss() {
+    std::ofstream os("/proc/self/clear_refs");
+    os << "5" << std::endl;
+    return static_cast<bool>(os);
+  }
+
+  struct MappedRss {
+    uint64_t lib = 0;
+    uint64_t stack = 0;
+    uint64_t heap = 0;
+  };
+
+  MappedRss read_smaps(const std::string& lib) {
+    std::ifstream is("/proc/self/smaps");
+    MappedRss rss;
+    uint64_t *current = nullptr;
+    unsigned long prev_stop = 0;
+    std::string line;
+    while (std::getline(is, line)) {
+      uint64_t kb;
+      unsigned long start, stop;
+      int name_offset = -1;
+      if (std::sscanf(line.c_str(), "%lx-%lx %*s %*s %*s %*s %n", &start, &stop, &name_offset) == 2 &&
+	  name_offset >= 0) {
+	const std::string name = line.substr(name_offset);
+	// The part of .bss past the file-backed pages is an anonymous mapping right after the library's.
+	const bool lib_bss = name.empty() && current == &rss.lib && start == prev_stop;
+	current = name == lib || lib_bss ? &rss.lib : name == "[stack]" ? &rss.stack : name == "[heap]" ? &rss.heap
+	  : nullptr;
+	prev_stop = stop;
+      } else if (std::sscanf(line.c_str(), "Rss: %" SCNu64 " kB", &kb) == 1 && current) {
+	*current += kb * 1024;
+      }
+    }
+    return rss;
+  }
+
+}
+
+int main(int argc, char *argv[]) {
+  FILE *f = stdout;
+  for (int i = 1; i < argc; ++i) {
+    const char *arg = argv[i];
+    std::vector<char> value(std::strlen(arg) + 1);
+    if (std::sscanf(arg, "--benchmark_out=%s", value.data()) == 1) {
+      if ((f = std::fopen(value.data(), "w")) == nullptr)
+	err(EXIT_FAILURE, "fopen: %s", value.data());
+    }
+  }
+
+  const std::string lib = find_library();
+  const SectionSizes sizes = get_section_sizes(lib);
+
+  benchmark::State state(BENCH_ARG);
+  const bool peak_reset = reset_peak_rss();
+  if (!peak_reset)
+    warnx("/proc/self/clear_refs: cannot reset the peak RSS; peak_rss covers the whole process");
+  const uint64_t rss_before = read_status("VmRSS");
+  SAFE_CALL(BENCH_NAME(state));
+  const uint64_t peak_rss = read_status("VmHWM");
+  const MappedRss mapped = read_smaps(lib);
+  struct rusage usage;
+  if (::getrusage(RUSAGE_SELF, &usage) < 0)
+    err(EXIT_FAILURE, "getrusage");
+
+  const char *run_name = XSTR(BENCH_NAME) "/" XSTR(BENCH_ARG);
+  std::fprintf(f, "{\n  \"context\": {\n    \"executable\": \"%s\",\n    \"library\": \"%s\",\n"
+	       "    \"peak_rss_reset\": %s\n  },\n"
+	       "  \"benchmarks\": [\n    {\n      \"name\": \"%s\",\n      \"run_name\": \"%s\",\n"
+	       "      \"run_type\": \"iteration\",\n      \"repetitions\": 1,\n      \"iterations\": 1,\n"
+	       "      \"real_time\": 0,\n      \"cpu_time\": 0,\n      \"time_unit\": \"ns\",\n"
+	       "      \"text_bytes\": %" PRIu64 ",\n      \"code_bytes\": %" PRIu64 ",\n"
+	       "      \"rodata_bytes\": %" PRIu64 ",\n      \"data_bytes\": %" PRIu64 ",\n"
+	       "      \"bss_bytes\": %" PRIu64 ",\n      \"tls_bytes\": %" PRIu64 ",\n"
+	       "      \"peak_rss_bytes\": %" PRIu64 ",\n      \"rss_growth_bytes\": %" PRIu64 ",\n"
+	       "      \"maxrss_bytes\": %" PRIu64 ",\n      \"lib_rss_bytes\": %" PRIu64 ",\n"
+	       "      \"stack_rss_bytes\": %" PRIu64 ",\n      \"heap_rss_bytes\": %" PRIu64 "\n    }\n  ]\n}\n",
+	       argv[0], lib.c_str(), peak_reset ? "true" : "false", run_name, run_name, sizes.text, sizes.code,
+	       sizes.rodata, sizes.data, sizes.bss, sizes.tls, peak_rss, peak_rss > rss_before ? peak_rss - rss_before : 0,
+	       static_cast<uint64_t>(usage.ru_maxrss) * 1024, mapped.lib, mapped.stack, mapped.heap);
+  if (std::fclose(f) != 0)
+    err(EXIT_FAILURE, "fclose");
+
+  std::fprintf(stderr, "%s: .text %" PRIu64 " B, .bss %" PRIu64 " B, peak RSS %" PRIu64 " KiB (+%" PRIu64 " KiB)\n",
+	       run_name, sizes.text, sizes.bss, peak_rss / 1024,
+	       (peak_rss > rss_before ? peak_rss - rss_before : 0) / 1024);
+}
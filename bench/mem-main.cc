@@ -7,6 +7,7 @@
 #include <sys/ptrace.h>
 #include <sys/mman.h>
 
+#include <algorithm>
 #include <sstream>
 #include <fstream>
 #include <string>
@@ -0,0 +1,360 @@
+// Scaling benchmark for the min-cut solvers (src/include/clou/MinCutGreedy.h, src/FordFulkerson.cc) on synthetic CFGs,
+// independent of LLVM IR.
+//
+// Each CFG is a random structured program of about `nodes` nodes built from straight-line code, diamonds, loops, and
+// switch fan-outs, plus a few unstructured "call-like" back edges (as from a callee's return to a call site's
+// successor). Edge weights grow with loop depth as in MitigatePass. `st_per_100` s-t pairs per 100 nodes are drawn
+// with 2 or 3 waypoint sets (like MitigatePass's {sources, store, transmitters}), each waypoint reachable from the
+// previous one. `shape` selects the mix of constructs (see shapes below). Graphs are seeded by their parameters, so
+// runs are comparable across commits.
+//
+// Reports time per solve and the counters nodes, edges, sts, iterations (MinCutGreedy passes to fixpoint), cut_edges,
+// cut_weight, and peak_heap_bytes (peak heap usage during the solve). LLVM options such as
+// -clou-min-cut-exact-threshold may be passed after the benchmark flags; the exact solver is off by default.
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdlib>
+#include <map>
+#include <new>
+#include <random>
+#include <set>
+#include <stack>
+#include <utility>
+#include <vector>
+
+#include <malloc.h>
+
+#include <benchmark/benchmark.h>
+#include <llvm/Support/CommandLine.h>
+
+#include "clou/FordFulkerson.h"
+#include "clou/MinCutGreedy.h"
+#include "clou/MinCutSMT.h"
+
+namespace {
+
+  /* Heap accounting, to report the solvers' peak heap usage. */
+  std::size_t heap_bytes = 0;
+  std::size_t heap_peak = 0;
+
+  void *allocate(std::size_t n) {
+    void *p = std::malloc(n ? n : 1);
+    if (p == nullptr)
+      throw std::bad_alloc();
+    heap_bytes += malloc_usable_size(p);
+    heap_peak = std::max(heap_peak, heap_bytes);
+    return p;
+  }
+
+  void deallocate(void *p) {
+    if (p == nullptr)
+      return;
+    heap_bytes -= malloc_usable_size(p);
+    std::free(p);
+  }
+
+}
+
+void *operator new(std::size_t n) { return allocate(n); }
+void *operator new[](std::size_t n) { return allocate(n); }
+void operator delete(void *p) noexcept { deallocate(p); }
+void operator delete[](void *p) noexcept { deallocate(p); }
+void operator delete(void *p, std::size_t) noexcept { deallocate(p); }
+void operator delete[](void *p, std::size_t) noexcept { deallocate(p); }
+
+namespace {
+
+  using Node = unsigned;
+  using Weight = unsigned;
+  using Graph = std::vector<std::map<Node, Weight>>;
+  using Waypoints = std::vector<std::set<Node>>;
+
+  enum Construct {Straight, Diamond, Loop, Switch, NumConstructs};
+
+  struct Shape {
+    const char *name;
+    unsigned weights[NumConstructs]; // relative frequency of each construct
+    double calls; // call-like back edges per node
+  };
+
+  const Shape shapes[] = {
+    {"mixed",    {2, 3, 2, 1}, 0.01},
+    {"loops",    {1, 1, 6, 0}, 0.01},
+    {"diamonds", {1, 6, 1, 0}, 0.01},
+    {"switches", {1, 1, 1, 4}, 0.01},
+    {"calls",    {2, 3, 2, 1}, 0.05},
+  };
+
+  class Generator {
+  public:
+    Generator(const Shape& shape, unsigned seed): shape(shape), rng(seed) {}
+
+    Graph G;
+    std::vector<unsigned> depth; // loop depth of each node
+
+    /* Builds a single-entry, single-exit region of about `budget` nodes. Returns its entry and exit. */
+    std::pair<Node, Node> region(unsigned budget, unsigned loop_depth) {
+      if (budget < 4)
+	return straight(std::max(budget, 1U), loop_depth);
+
+      std::discrete_distribution<int> construct(std::begin(shape.weights), std::end(shape.weights));
+      switch (construct(rng)) {
+      case Straight: {
+	// A sequence of 2-4 sub-regions.
+	const unsigned parts = uniform(2, 4);
+	const auto [entry, exit] = region(budget / parts, loop_depth);
+	Node last = exit;
+	for (unsigned i = 1; i < parts; ++i) {
+	  const auto [sub_entry, sub_exit] = region(budget / parts, loop_depth);
+	  edge(last, sub_entry);
+	  last = sub_exit;
+	}
+	return {entry, last};
+      }
+
+      case Diamond: {
+	const Node head = node(loop_depth);
+	const Node join = node(loop_depth);
+	const bool has_else = uniform(0, 3) > 0;
+	const unsigned arms = has_else ? 2 : 1;
+	for (unsigned i = 0; i < arms; ++i) {
+	  const auto [arm_entry, arm_exit] = region((budget - 2) / arms, loop_depth);
+	  edge(head, arm_entry);
+	  edge(arm_exit, join);
+	}
+	if (!has_else)
+	  edge(head, join);
+	return {head, join};
+      }
+
+      case Loop: {
+	const Node header = node(loop_depth + 1);
+	const Node exit = node(loop_depth);
+	const auto [body_entry, body_exit] = region(budget - 2, loop_depth + 1);
+	edge(header, body_entry);
+	edge(body_exit, header);
+	edge(header, exit);
+	return {header, exit};
+      }
+
+      case Switch: {
+	const Node head = node(loop_depth);
+	const Node join = node(loop_depth);
+	const unsigned cases = std::min(uniform(3, 8), budget - 2);
+	for (unsigned i = 0; i < cases; ++i) {
+	  const auto [case_entry, case_exit] = region((budget - 2) / cases, loop_depth);
+	  edge(head, case_entry);
+	  edge(case_exit, join);
+	}
+	return {head, join};
+      }
+
+      default:
+	std::abort();
+      }
+    }
+
+    /* Adds call-like back edges, from random nodes to random earlier nodes. */
+    void calls() {
+      const unsigned n = G.size() * shape.calls;
+      for (unsigned i = 0; i < n; ++i) {
+	const Node src = uniform(1, G.size() - 1);
+	edge(src, uniform(0, src - 1));
+      }
+    }
+
+    /* Returns `n` s-t pairs, each with 2 or 3 waypoint sets, where each waypoint is reachable from the previous one. */
+    std::vector<Waypoints> sts(unsigned n) {
+      std::vector<Waypoints> result;
+      while (result.size() < n) {
+	Waypoints st;
+	std::vector<Node> frontier = {uniform(0, G.size() - 1)};
+	const unsigned sets = uniform(2, 3);
+	for (unsigned i = 0; i < sets; ++i) {
+	  std::set<Node>& waypoint = st.emplace_back();
+	  const unsigned size = uniform(1, i + 1 < sets ? 2 : 4);
+	  for (unsigned j = 0; j < size; ++j)
+	    waypoint.insert(frontier[uniform(0, frontier.size() - 1)]);
+	  frontier = reach(waypoint);
+	  if (frontier.empty())
+	    break;
+	}
+	if (st.size() == sets)
+	  result.push_back(std::move(st));
+      }
+      return result;
+    }
+
+  private:
+    const Shape& shape;
+    std::mt19937 rng;
+
+    unsigned uniform(unsigned lo, unsigned hi) {
+      return std::uniform_int_distribution<unsigned>(lo, hi)(rng);
+    }
+
+    Node node(unsigned loop_depth) {
+      G.emplace_back();
+      depth.push_back(loop_depth);
+      return G.size() - 1;
+    }
+
+    void edge(Node src, Node dst) {
+      // Same weighting as MitigatePass: (loop depth + 1)^LoopWeight * 1000, with LoopWeight = 2.
+      G[src][dst] = std::pow(std::min(depth[src], 8U) + 1, 2) * 1000;
+    }
+
+    std::pair<Node, Node> straight(unsigned n, unsigned loop_depth) {
+      const Node entry = node(loop_depth);
+      Node last = entry;
+      for (unsigned i = 1; i < n; ++i) {
+	const Node next = node(loop_depth);
+	edge(last, next);
+	last = next;
+      }
+      return {entry, last};
+    }
+
+    std::vector<Node> reach(const std::set<Node>& from) const {
+      std::vector<bool> seen(G.size(), false);
+      std::stack<Node> todo;
+      for (Node u : from)
+	todo.push(u);
+      std::vector<Node> result;
+      while (!todo.empty()) {
+	const Node u = todo.top();
+	todo.pop();
+	for (const auto& [v, w] : G[u]) {
+	  if (!seen[v]) {
+	    seen[v] = true;
+	    result.push_back(v);
+	    todo.push(v);
+	  }
+	}
+      }
+      return result;
+    }
+  };
+
+  struct Input {
+    Graph G;
+    std::vector<Waypoints> sts;
+    std::size_t edges = 0;
+  };
+
+  /* Returns the input for the benchmark's arguments, generating it on first use. */
+  const Input& get_input(const benchmark::State& state) {
+    static std::map<std::vector<int64_t>, Input> cache;
+    const std::vector<int64_t> key = {state.range(0), state.range(1), state.range(2)};
+    auto it = cache.find(key);
+    if (it == cache.end()) {
+      const unsigned nodes = state.range(0);
+      Generator gen(shapes[state.range(2)], nodes * 1000003 + state.range(1) * 101 + state.range(2));
+      gen.region(nodes, 0);
+      gen.calls();
+      Input input;
+      input.sts = gen.sts(std::max<unsigned>(nodes * state.range(1) / 100, 1));
+      input.G = std::move(gen.G);
+      for (const auto& dsts : input.G)
+	input.edges += dsts.size();
+      it = cache.emplace(key, std::move(input)).first;
+    }
+    return it->second;
+  }
+
+  void set_counters(benchmark::State& state, const Input& input, std::size_t cut_edges, uint64_t cut_weight,
+		    std::size_t peak) {
+    state.SetLabel(shapes[state.range(2)].name);
+    state.counters["nodes"] = input.G.size();
+    state.counters["edges"] = input.edges;
+    state.counters["sts"] = input.sts.size();
+    state.counters["cut_edges"] = cut_edges;
+    state.counters["cut_weight"] = cut_weight;
+    state.counters["peak_heap_bytes"] = peak;
+  }
+
+  void BM_MinCutGreedy(benchmark::State& state) {
+    const Input& input = get_input(state);
+    std::size_t cut_edges = 0;
+    uint64_t cut_weight = 0;
+    unsigned iterations = 0;
+    std::size_t peak = 0;
+    for (auto _ : state) {
+      state.PauseTiming();
+      {
+	clou::MinCutGreedy<Node> alg;
+	for (Node u = 0; u < input.G.size(); ++u)
+	  for (const auto& [v, w] : input.G[u])
+	    alg.G[u][v] = w;
+	for (const Waypoints& st : input.sts) {
+	  if (st.size() == 2)
+	    alg.add_st(st[0], st[1]);
+	  else
+	    alg.add_st(st[0], st[1], st[2]);
+	}
+	const std::size_t base = heap_bytes;
+	heap_peak = heap_bytes;
+	state.ResumeTiming();
+
+	alg.run();
+
+	state.PauseTiming();
+	peak = heap_peak - base;
+	iterations = alg.iterations;
+	cut_edges = alg.cut_edges.size();
+	cut_weight = 0;
+	for (const auto& e : alg.cut_edges)
+	  cut_weight += input.G[e.src].at(e.dst);
+      }
+      state.ResumeTiming();
+    }
+    set_counters(state, input, cut_edges, cut_weight, peak);
+    state.counters["iterations"] = iterations;
+  }
+
+  /* Computes an independent multi-waypoint min cut for each s-t pair (no sharing of cut edges between pairs). */
+  void BM_ford_fulkerson_multi(benchmark::State& state) {
+    const Input& input = get_input(state);
+    std::size_t cut_edges = 0;
+    uint64_t cut_weight = 0;
+    std::size_t peak = 0;
+    for (auto _ : state) {
+      const std::size_t base = heap_bytes;
+      heap_peak = heap_bytes;
+      cut_edges = 0;
+      cut_weight = 0;
+      for (const Waypoints& st : input.sts) {
+	const auto cut = clou::ford_fulkerson_multi(input.G, st);
+	cut_edges += cut.size();
+	for (const auto& [u, v] : cut)
+	  cut_weight += input.G[u].at(v);
+      }
+      peak = heap_peak - base;
+    }
+    set_counters(state, input, cut_edges, cut_weight, peak);
+  }
+
+  void args(benchmark::internal::Benchmark *b) {
+    b->ArgNames({"nodes", "st_per_100", "shape"});
+    for (int64_t shape = 0; shape < static_cast<int64_t>(std::size(shapes)); ++shape)
+      for (int64_t nodes = 256; nodes <= 16384; nodes *= 4)
+	for (int64_t density : {1, 5, 20})
+	  b->Args({nodes, density, shape});
+    b->Unit(benchmark::kMillisecond);
+  }
+
+}
+
+BENCHMARK(BM_MinCutGreedy)->Apply(args);
+BENCHMARK(BM_ford_fulkerson_multi)->Apply(args);
+
+int main(int argc, char *argv[]) {
+  // Measure the greedy solver on its own unless asked otherwise.
+  clou::exact_min_cut_threshold = 0;
+  benchmark::Initialize(&argc, argv);
+  llvm::cl::ParseCommandLineOptions(argc, argv);
+  benchmark::RunSpecifiedBenchmarks();
+  benchmark::Shutdown();
+}
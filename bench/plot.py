@@ -7,10 +7,18 @@ import pandas
 import seaborn
 import matplotlib.pyplot as plt
 import math
+import numpy as np
+
+import benchstats
 
 parser = argparse.ArgumentParser()
 parser.add_argument('json', nargs = '+')
 parser.add_argument('-o', dest = 'out')
+parser.add_argument('-k', dest = 'key', help = 'JSON key of the metric to plot (default: inferred from the filenames)')
+parser.add_argument('--baseline', default = 'base', help = 'mode that overheads are relative to (default: %(default)s)')
+parser.add_argument('--confidence', type = float, default = 0.95, help = 'confidence level of the error bars (default: %(default)s)')
+parser.add_argument('--resamples', type = int, default = 2000, help = 'bootstrap resamples (default: %(default)s)')
+parser.add_argument('--seed', type = int, default = 0)
 args = parser.parse_args()
 
 def get_basename(path):
@@ -19,8 +27,7 @@ def get_basename(path):
 # Infer the metric from the filenames
 
 metric = get_basename(args.json[0]).split('_', maxsplit = 1)[0]
-metric_keys = {'time': 'cpu_time'}
-metric_key = metric_keys[metric] if metric in metric_keys else metric
+metric_key = args.key or benchstats.metric_key(metric)
 
 # From the JSON filenames, we can gather the exact benchmarks.
 # time_<lib>_<size>_<mode>.json
@@ -43,16 +50,11 @@ for jsonpath in args.json:
     benchtype, lib, name, size, mode = os.path.basename(os.path.splitext(jsonpath)[0]).split('_', maxsplit = 4)
 
     benchmark = (lib, name, size)
-    with open(jsonpath, 'r') as f:
-        j = json.load(f)
-    # strip away unneeded information in json
-    j_ = None
-    for result in j['benchmarks']:
-        if result['name'] == f'{lib}_{name}/{size}_mean':
-            j_ = result
-            break
-    assert j_ != None
-    benchmarks[benchmark][mode] = j_
+    # Per-repetition samples, so that the overheads get confidence intervals (see benchstats.py).
+    samples = benchstats.load_samples(jsonpath, metric_key)
+    run_name = f'{lib}_{name}/{size}'
+    assert run_name in samples, f'{jsonpath}: no {metric_key} for {run_name}'
+    benchmarks[benchmark][mode] = samples[run_name]
 
 # assemble results into table
 data = {
@@ -62,6 +64,8 @@ data = {
 }
 
 geomean_in = defaultdict(list)
+# (benchmark displayname, mitigation displayname) -> (lo, hi) of the overhead
+errorbars = {}
 
 def mitigation_displayname(mitigation):
     return mitigation.split('_', maxsplit = 1)[-1]
@@ -72,42 +76,55 @@ def benchmark_displayname(lib, name, size):
 # TODO: have option for absolute-number style barcharts, not just overhead-style.
 is_absolute = (metric == 'mitigation')
 
+rng = np.random.default_rng(args.seed)
+alpha = (1 - args.confidence) / 2
+
 for benchmark in benchmarks:
     results = benchmarks[benchmark]
-    baseline = results['baseline_none']
-    baseline_metric = baseline[metric_key]
+    baseline = results[args.baseline]
     for mitigation, result in results.items():
-        if mitigation == 'baseline_none':
+        if mitigation == args.baseline:
             continue
-        mitigation_metric = result[metric_key]
 
         if is_absolute:
-            overhead = mitigation_metric
-        elif baseline_metric == 0:
-            overhead = 0
+            overhead = np.mean(result)
+            replicates = None
         else:
-            overhead = (mitigation_metric - baseline_metric) / baseline_metric * 100
+            overhead, ci, replicates = benchstats.bootstrap_change(baseline, result, args.resamples, args.confidence, rng)
+            errorbars[(benchmark_displayname(*benchmark), mitigation_displayname(mitigation))] = ci
         data['benchmark'].append(benchmark_displayname(*benchmark))
         data['overhead'].append(overhead)
         data['mitigation'].append(mitigation_displayname(mitigation))
 
-        geomean_in[mitigation].append(overhead)
+        geomean_in[mitigation].append((overhead, replicates))
+
+def geomean(overheads):
+    l1 = np.asarray(overheads) / 100 + 1
+    return (np.prod(l1, axis = 0) ** (1 / len(l1)) - 1) * 100
 
 scores = {}
-        
+
 for mitigation, l in geomean_in.items():
+    overheads = [overhead for overhead, _ in l]
+    y = float(geomean(overheads))
     data['benchmark'].append('geomean')
-    l1 = [x / 100 + 1 for x in l]
-    x = math.prod(l1) ** (1 / len(l))
-    y = (x - 1) * 100
     data['overhead'].append(y)
     data['mitigation'].append(mitigation_displayname(mitigation))
-    scores[mitigation_displayname(mitigation)] = y
+    scores[mitigation_displayname(mitigation)] = (y, None)
 
     data['benchmark'].append('arithmean')
-    data['overhead'].append(sum(l) / len(l))
+    data['overhead'].append(sum(overheads) / len(overheads))
     data['mitigation'].append(mitigation_displayname(mitigation))
 
+    if not is_absolute:
+        # The benchmarks are resampled independently, so combining the i-th replicates gives replicates of the means.
+        replicates = np.array([replicates for _, replicates in l])
+        geomean_ci = tuple(np.quantile(geomean(replicates), [alpha, 1 - alpha]))
+        errorbars[('geomean', mitigation_displayname(mitigation))] = geomean_ci
+        errorbars[('arithmean', mitigation_displayname(mitigation))] = \
+            tuple(np.quantile(replicates.mean(axis = 0), [alpha, 1 - alpha]))
+        scores[mitigation_displayname(mitigation)] = (y, geomean_ci)
+
 
 aspect = 2
     
@@ -149,6 +166,19 @@ for c in ax.containers:
             v.set_height(min(v.get_height(), ymax))
     texts = ax.bar_label(c, labels = labels, label_type = 'edge', rotation = 90, fontsize = 'small')
 
+# error bars: each hue is a container, and bars are centered on the index of their benchmark
+benchmark_order = list(dict.fromkeys(df['benchmark']))
+mitigation_order = list(dict.fromkeys(df['mitigation']))
+for c, mitigation in zip(list(ax.containers), mitigation_order):
+    for v in c:
+        x = v.get_x() + v.get_width() / 2
+        key = (benchmark_order[round(x)], mitigation)
+        if key not in errorbars:
+            continue
+        lo, hi = errorbars[key]
+        val = v.get_height()
+        ax.errorbar(x, val, yerr = [[max(val - lo, 0)], [max(hi - val, 0)]], fmt = 'none', ecolor = 'black',
+                    elinewidth = 0.75, capsize = 1.5)
     
 plt.legend(
 #    loc = 'upper center',
@@ -160,5 +190,5 @@ if args.out:
 
 # also write file
 with open(args.out + '.txt', 'w') as f:
-    for mitigation, score in scores.items():
-        print(f'{mitigation} {score:.2f}', file = f)
+    for mitigation, (score, ci) in scores.items():
+        print(f'{mitigation} {score:.2f}' + (f' [{ci[0]:.2f}, {ci[1]:.2f}]' if ci else ''), file = f)
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <cmath>
 #include <cstdio>
 #include <cstring>
 #include <vector>
@@ -48,27 +49,35 @@ int main(int argc, char *argv[]) {
       measurements[i] = execute(argv);
     }
 
-    // compute average
+    // compute average and standard deviation
     const double mean = std::accumulate(measurements.begin(), measurements.end(), 0.) / measurements.size();
-#if 0
     const double variance = std::accumulate(measurements.begin(), measurements.end(), 0., [mean] (double acc, double newval) {
       const double diff = newval - mean;
       return acc + diff * diff;
-    }) / measurements.size();
+    }) / (measurements.size() > 1 ? measurements.size() - 1 : 1);
     const double stddev = std::sqrt(variance);
-#endif
 
+    // One entry per repetition, so that compare.py and plot.py can compute confidence intervals, then the aggregates.
+    std::fprintf(f, "{\n  \"benchmarks\": [");
+    for (unsigned i = 0; i < repetitions; ++i) {
+      std::fprintf(f, "\n    {\n      \"name\": \"%s/%d\",\n      \"run_name\": \"%s/%d\",\n"
+		   "      \"run_type\": \"iteration\",\n      \"repetition_index\": %u,\n      \"%s\": %f\n    },",
+		   XSTR(BENCH_NAME), BENCH_ARG, XSTR(BENCH_NAME), BENCH_ARG, i, XSTR(BENCH_METRIC), measurements[i]);
+    }
     const char *fmt = R"=(
-{
-  "benchmarks": [
     {
-      "name": "%s/%d_mean",
+      "name": "%s/%d_%s",
+      "run_name": "%s/%d",
+      "run_type": "aggregate",
+      "aggregate_name": "%s",
       "%s": %f
-    }
-  ]
-}
-)=";
-    std::fprintf(f, fmt, XSTR(BENCH_NAME), BENCH_ARG, XSTR(BENCH_METRIC), mean);
+    })=";
+    std::fprintf(f, fmt, XSTR(BENCH_NAME), BENCH_ARG, "mean", XSTR(BENCH_NAME), BENCH_ARG, "mean", XSTR(BENCH_METRIC),
+		 mean);
+    std::fprintf(f, ",");
+    std::fprintf(f, fmt, XSTR(BENCH_NAME), BENCH_ARG, "stddev", XSTR(BENCH_NAME), BENCH_ARG, "stddev",
+		 XSTR(BENCH_METRIC), stddev);
+    std::fprintf(f, "\n  ]\n}\n");
   }
 }
 #endif
@@ -31,7 +31,7 @@ extern "C" {
 # error "No library defined"
 #endif
 
-#if defined(BENCH_TIME)
+#if defined(BENCH_TIME) || defined(BENCH_THROUGHPUT)
 # include <benchmark/benchmark.h>
 #else
 // #elif defined(BENCH_MEM) || defined(BENCH_CACHE) || defined(BENCH_STALL) || defined(BENCH_INST)
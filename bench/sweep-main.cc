@@ -0,0 +1,125 @@
+// Message-size sweep: runs BENCH_NAME on input sizes from --sweep_min (default 16) to --sweep_max (default 1 MiB),
+// multiplying by --sweep_multiplier (default 2), and times every call individually with the TSC (see
+// benchmark::State in benchmark_memory.h), so setup outside the benchmark loop is excluded.
+//
+// For each size, calls are repeated for about --sweep_time seconds (default 0.5), between 1000 and 100000 times, and
+// Google-Benchmark-style JSON entries "<name>/<size>_<aggregate>" are written for the mean, p50, p99 and p99.9, with
+// real_time/cpu_time in ns, "cycles" in TSC (reference) cycles, and "bytes_per_cycle".
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#include <err.h>
+
+#include "shared.h"
+#include "shared-main.h"
+
+#define STR(x) #x
+#define XSTR(x) STR(x)
+
+namespace {
+
+  /* Measures the TSC frequency, in ticks per nanosecond. */
+  double tsc_per_ns() {
+    const auto start = std::chrono::steady_clock::now();
+    const uint64_t tsc_start = __rdtsc();
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    const uint64_t tsc_stop = __rdtsc();
+    const auto stop = std::chrono::steady_clock::now();
+    return (tsc_stop - tsc_start) / std::chrono::duration<double, std::nano>(stop - start).count();
+  }
+
+  /* Returns the latency of each of `calls` iterations of the benchmark on `size` bytes, in TSC ticks. */
+  std::vector<double> measure(size_t size, size_t calls) {
+    std::vector<uint64_t> timestamps;
+    timestamps.reserve(calls + 1);
+    benchmark::State state(size, calls, &timestamps);
+    SAFE_CALL(BENCH_NAME(state));
+    std::vector<double> latencies(calls);
+    for (size_t i = 0; i < calls; ++i)
+      latencies[i] = timestamps[i + 1] - timestamps[i];
+    return latencies;
+  }
+
+  double percentile(const std::vector<double>& sorted, double p) {
+    const double rank = p / 100 * (sorted.size() - 1);
+    const size_t lo = std::floor(rank);
+    const size_t hi = std::ceil(rank);
+    return sorted[lo] + (sorted[hi] - sorted[lo]) * (rank - lo);
+  }
+
+}
+
+int main(int argc, char *argv[]) {
+  FILE *f = stdout;
+  size_t min_size = 16;
+  size_t max_size = 1 << 20;
+  unsigned multiplier = 2;
+  double budget = 0.5;
+  for (int i = 1; i < argc; ++i) {
+    const char *arg = argv[i];
+    std::vector<char> value(std::strlen(arg) + 1);
+    if (std::sscanf(arg, "--benchmark_out=%s", value.data()) == 1) {
+      if ((f = std::fopen(value.data(), "w")) == nullptr)
+	err(EXIT_FAILURE, "fopen: %s", value.data());
+    } else if (std::sscanf(arg, "--sweep_min=%zu", &min_size) == 1) {
+    } else if (std::sscanf(arg, "--sweep_max=%zu", &max_size) == 1) {
+    } else if (std::sscanf(arg, "--sweep_multiplier=%u", &multiplier) == 1) {
+    } else if (std::sscanf(arg, "--sweep_time=%lf", &budget) == 1) {
+    }
+  }
+  if (min_size == 0 || multiplier < 2)
+    errx(EXIT_FAILURE, "--sweep_min must be positive and --sweep_multiplier at least 2");
+
+  const double tsc_ns = tsc_per_ns();
+  const char *name = XSTR(BENCH_NAME);
+
+  std::fprintf(f, "{\n  \"context\": {\n    \"executable\": \"%s\",\n    \"tsc_ghz\": %f\n  },\n  \"benchmarks\": [", argv[0],
+	       tsc_ns);
+  bool first = true;
+  for (size_t size = min_size; size <= max_size; size *= multiplier) {
+    // Warm up and estimate the latency to fit the time budget.
+    std::vector<double> latencies = measure(size, 10);
+    std::sort(latencies.begin(), latencies.end());
+    const double estimate_ns = percentile(latencies, 50) / tsc_ns;
+    const size_t calls = std::clamp<size_t>(budget * 1e9 / std::max(estimate_ns, 1.), 1000, 100000);
+
+    latencies = measure(size, calls);
+    std::sort(latencies.begin(), latencies.end());
+    double sum = 0;
+    for (double latency : latencies)
+      sum += latency;
+
+    const struct {
+      const char *name;
+      double cycles;
+    } aggregates[] = {
+      {"mean", sum / calls},
+      {"p50", percentile(latencies, 50)},
+      {"p99", percentile(latencies, 99)},
+      {"p99.9", percentile(latencies, 99.9)},
+    };
+    for (const auto& agg : aggregates) {
+      const double ns = agg.cycles / tsc_ns;
+      std::fprintf(f, "%s\n    {\n      \"name\": \"%s/%zu_%s\",\n      \"run_name\": \"%s/%zu\",\n"
+		   "      \"run_type\": \"aggregate\",\n      \"aggregate_name\": \"%s\",\n      \"iterations\": %zu,\n"
+		   "      \"bytes\": %zu,\n      \"real_time\": %f,\n      \"cpu_time\": %f,\n      \"time_unit\": \"ns\",\n"
+		   "      \"cycles\": %f,\n      \"bytes_per_cycle\": %f\n    }",
+		   first ? "" : ",", name, size, agg.name, name, size, agg.name, calls, size, ns, ns, agg.cycles,
+		   size / agg.cycles);
+      first = false;
+    }
+    std::fprintf(stderr, "%s/%zu: p50 %.0f ns, p99 %.0f ns (%zu calls)\n", name, size, aggregates[1].cycles / tsc_ns,
+		 aggregates[2].cycles / tsc_ns, calls);
+  }
+  std::fprintf(f, "\n  ]\n}\n");
+  if (std::fclose(f) != 0)
+    err(EXIT_FAILURE, "fclose");
+}
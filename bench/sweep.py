@@ -0,0 +1,54 @@
+# Plots the results of the message-size sweep (sweep-main.cc): for each primitive, the overhead of each mitigation
+# mode's per-call latency over the `base` mode, as a function of input size. Also prints the table being plotted.
+# Input files are named sweep_<lib>_<name>_all_<mode>.json.
+
+import argparse
+import json
+import os
+from collections import defaultdict
+import matplotlib.pyplot as plt
+
+parser = argparse.ArgumentParser()
+parser.add_argument('json', nargs = '+')
+parser.add_argument('-o', dest = 'out')
+parser.add_argument('-a', dest = 'aggregate', default = 'p50', choices = ['mean', 'p50', 'p99', 'p99.9'])
+parser.add_argument('--baseline', default = 'base')
+args = parser.parse_args()
+
+# (lib, name) -> mode -> size -> (ns, bytes/cycle)
+results = defaultdict(lambda: defaultdict(dict))
+for jsonpath in args.json:
+    benchtype, lib, name, arg, mode = os.path.basename(os.path.splitext(jsonpath)[0]).split('_', maxsplit = 4)
+    with open(jsonpath) as f:
+        for result in json.load(f)['benchmarks']:
+            if result['aggregate_name'] == args.aggregate:
+                results[(lib, name)][mode][result['bytes']] = (result['real_time'], result['bytes_per_cycle'])
+
+benchmarks = sorted(results)
+fig, axes = plt.subplots(len(benchmarks), 1, figsize = (6, 3 * len(benchmarks)), squeeze = False)
+for ax, benchmark in zip(axes[:, 0], benchmarks):
+    modes = results[benchmark]
+    baseline = modes.get(args.baseline)
+    if baseline is None:
+        print(f'warning: no {args.baseline} results for {"_".join(benchmark)}')
+        continue
+    print(f'{"_".join(benchmark)} ({args.aggregate} latency overhead over {args.baseline}):')
+    for mode in sorted(modes):
+        if mode == args.baseline:
+            continue
+        sizes = sorted(size for size in modes[mode] if size in baseline)
+        overheads = [(modes[mode][size][0] - baseline[size][0]) / baseline[size][0] * 100 for size in sizes]
+        ax.plot(sizes, overheads, marker = '.', label = mode)
+        print(f'  {mode:<28} ' + ' '.join(f'{size}:{overhead:.0f}%' for size, overhead in zip(sizes, overheads)))
+    ax.set_xscale('log', base = 2)
+    ax.set_xlabel('input size (bytes)')
+    ax.set_ylabel(f'{args.aggregate} latency overhead (%)')
+    ax.set_title('_'.join(benchmark))
+    ax.axhline(0, color = 'gray', linewidth = 0.5)
+    ax.legend(fontsize = 'small')
+
+fig.tight_layout()
+if args.out:
+    fig.savefig(args.out)
+else:
+    plt.show()
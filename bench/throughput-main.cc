@@ -0,0 +1,150 @@
+// Throughput driver: runs BENCH_NAME concurrently on 1, 2, 4, ..., $THREADS threads (default: all hardware threads),
+// each thread with its own inputs, and reports operations per second (items_per_second) and scaling efficiency
+// (throughput on N threads / (N * throughput on 1 thread)) for each thread count.
+//
+// Modes whose mitigations are not thread-safe define __llsct_thread_unsafe (see util::markThreadUnsafe); those, and
+// any library that crashes or hangs in a multi-threaded probe run, are measured on one thread only and the reason is
+// recorded as "thread_unsafe" in the JSON context.
+
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <err.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <benchmark/benchmark.h>
+
+#include "shared.h"
+#include "shared-main.h"
+
+#define STR(x) #x
+#define XSTR(x) STR(x)
+
+extern "C" __attribute__((weak)) const char __llsct_thread_unsafe[];
+
+namespace {
+
+  void BM_throughput(benchmark::State& state) {
+    BENCH_NAME(state);
+    state.SetItemsProcessed(state.iterations());
+  }
+
+  class NullReporter final : public benchmark::BenchmarkReporter {
+  public:
+    bool ReportContext(const Context&) override { return true; }
+    void ReportRuns(const std::vector<Run>&) override {}
+  };
+
+  /* Adds an "efficiency" counter to each run, relative to the single-threaded run with the same aggregate. */
+  class EfficiencyReporter final : public benchmark::BenchmarkReporter {
+  public:
+    explicit EfficiencyReporter(benchmark::BenchmarkReporter& inner): inner(inner) {}
+
+    bool ReportContext(const Context& context) override {
+      // RunSpecifiedBenchmarks sets the streams of the reporter it is given, i.e. ours.
+      inner.SetOutputStream(&GetOutputStream());
+      inner.SetErrorStream(&GetErrorStream());
+      return inner.ReportContext(context);
+    }
+
+    void ReportRuns(const std::vector<Run>& runs) override {
+      std::vector<Run> out = runs;
+      for (Run& run : out) {
+	const auto it = run.counters.find("items_per_second");
+	if (it == run.counters.end() || run.aggregate_name == "stddev" || run.aggregate_name == "cv")
+	  continue;
+	if (run.threads == 1)
+	  single[run.aggregate_name] = it->second.value;
+	const auto base = single.find(run.aggregate_name);
+	if (base != single.end() && base->second > 0)
+	  run.counters["efficiency"] = it->second.value / (run.threads * base->second);
+      }
+      inner.ReportRuns(out);
+    }
+
+    void Finalize() override {
+      inner.Finalize();
+    }
+
+  private:
+    benchmark::BenchmarkReporter& inner;
+    std::map<std::string, double> single; // items per second on one thread, by aggregate name
+  };
+
+  /* Runs the benchmark on `threads` threads in a child process. Returns why it failed, or the empty string. */
+  std::string probe(int threads) {
+    std::fflush(nullptr);
+    const pid_t pid = fork();
+    if (pid < 0) {
+      err(EXIT_FAILURE, "fork");
+    } else if (pid == 0) {
+      alarm(60);
+      benchmark::RegisterBenchmark("probe", BM_throughput)->Arg(BENCH_ARG)->Threads(threads)->Iterations(64);
+      NullReporter reporter;
+      benchmark::RunSpecifiedBenchmarks(&reporter);
+      std::_Exit(EXIT_SUCCESS);
+    }
+
+    int status;
+    if (waitpid(pid, &status, 0) < 0)
+      err(EXIT_FAILURE, "waitpid");
+    char buf[256];
+    if (WIFSIGNALED(status)) {
+      std::snprintf(buf, sizeof buf, "%s on %d threads", WTERMSIG(status) == SIGALRM ? "timed out" : strsignal(WTERMSIG(status)),
+		    threads);
+      return buf;
+    } else if (WEXITSTATUS(status) != EXIT_SUCCESS) {
+      std::snprintf(buf, sizeof buf, "exited with status %d on %d threads", WEXITSTATUS(status), threads);
+      return buf;
+    }
+    return "";
+  }
+
+}
+
+int main(int argc, char *argv[]) {
+  int max_threads = std::thread::hardware_concurrency();
+  if (const char *s = std::getenv("THREADS"))
+    max_threads = std::atoi(s);
+  if (max_threads < 1)
+    max_threads = 1;
+
+  bool has_out = false;
+  for (int i = 1; i < argc; ++i)
+    if (std::strncmp(argv[i], "--benchmark_out=", std::strlen("--benchmark_out=")) == 0)
+      has_out = true;
+
+  // Probe before parsing flags, so that the probe does not write --benchmark_out.
+  std::string unsafe;
+  if (const char *marker = __llsct_thread_unsafe)
+    unsafe = marker;
+  else if (max_threads > 1)
+    unsafe = probe(max_threads);
+
+  benchmark::Initialize(&argc, argv);
+  if (benchmark::ReportUnrecognizedArguments(argc, argv))
+    return EXIT_FAILURE;
+
+  auto *bench = benchmark::RegisterBenchmark(XSTR(BENCH_NAME), BM_throughput)->Arg(BENCH_ARG)->UseRealTime();
+  if (unsafe.empty()) {
+    bench->ThreadRange(1, max_threads);
+  } else {
+    std::fprintf(stderr, "warning: not thread-safe, measuring one thread only: %s\n", unsafe.c_str());
+    benchmark::AddCustomContext("thread_unsafe", unsafe);
+    bench->Threads(1);
+  }
+  benchmark::AddCustomContext("max_threads", std::to_string(max_threads));
+
+  EfficiencyReporter display(*benchmark::CreateDefaultDisplayReporter());
+  benchmark::JSONReporter json;
+  EfficiencyReporter file(json);
+  benchmark::RunSpecifiedBenchmarks(&display, has_out ? &file : nullptr);
+  benchmark::Shutdown();
+}
@@ -0,0 +1,30 @@
+# Summarizes throughput_<lib>_<name>_<size>_<mode>.json files (from throughput-main.cc) as a table of operations per
+# second and scaling efficiency for each benchmark, mitigation mode, and thread count.
+
+import argparse
+import json
+import os
+import sys
+
+parser = argparse.ArgumentParser()
+parser.add_argument('json', nargs = '+')
+parser.add_argument('-o', dest = 'out')
+args = parser.parse_args()
+
+rows = []
+for jsonpath in args.json:
+    benchtype, lib, name, size, mode = os.path.basename(os.path.splitext(jsonpath)[0]).split('_', maxsplit = 4)
+    with open(jsonpath) as f:
+        j = json.load(f)
+    unsafe = j['context'].get('thread_unsafe', '')
+    # With --benchmark_repetitions, report the median of the repetitions.
+    results = [result for result in j['benchmarks'] if result.get('aggregate_name') == 'median'] or j['benchmarks']
+    for result in results:
+        rows.append((f'{lib}_{name}_{size}', mode, result['threads'], result['items_per_second'],
+                     result.get('efficiency', float('nan')), unsafe))
+
+f = open(args.out, 'w') if args.out else sys.stdout
+print(f'{"benchmark":<28} {"mode":<28} {"threads":>7} {"ops/s":>14} {"efficiency":>10}  note', file = f)
+for bench, mode, threads, ops, efficiency, unsafe in sorted(rows):
+    note = f'not thread-safe: {unsafe}' if unsafe else ''
+    print(f'{bench:<28} {mode:<28} {threads:>7} {ops:>14.1f} {efficiency:>10.3f}  {note}', file = f)
@@ -0,0 +1,87 @@
+// Micro-benchmark for the zeroing sequences emitted by clou::CreateZero (src/Zeroing.cc), compared against memset.
+// Each strategy zeroes a buffer of the benchmark argument's size; use --benchmark_filter to select strategies.
+
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <immintrin.h>
+
+#include <benchmark/benchmark.h>
+
+namespace {
+
+  constexpr std::size_t max_size = 1 << 22;
+  alignas(64) unsigned char buf[max_size];
+
+  void zero_memset(unsigned char *p, std::size_t n) {
+    std::memset(p, 0, n);
+  }
+
+  void zero_rep_stosb(unsigned char *p, std::size_t n) {
+    asm volatile ("rep stosb" : "+D"(p), "+c"(n) : "a"(0) : "memory");
+  }
+
+  __attribute__((target("sse2")))
+  void zero_sse(unsigned char *p, std::size_t n) {
+    const __m128i z = _mm_setzero_si128();
+    for (std::size_t i = 0; i < n; i += 16)
+      _mm_store_si128(reinterpret_cast<__m128i *>(p + i), z);
+  }
+
+  __attribute__((target("avx")))
+  void zero_avx(unsigned char *p, std::size_t n) {
+    const __m256i z = _mm256_setzero_si256();
+    for (std::size_t i = 0; i < n; i += 32)
+      _mm256_store_si256(reinterpret_cast<__m256i *>(p + i), z);
+  }
+
+  __attribute__((target("avx512f")))
+  void zero_avx512(unsigned char *p, std::size_t n) {
+    const __m512i z = _mm512_setzero_si512();
+    for (std::size_t i = 0; i < n; i += 64)
+      _mm512_store_si512(reinterpret_cast<__m512i *>(p + i), z);
+  }
+
+  __attribute__((target("avx")))
+  void zero_nontemporal(unsigned char *p, std::size_t n) {
+    const __m256i z = _mm256_setzero_si256();
+    for (std::size_t i = 0; i < n; i += 32)
+      _mm256_stream_si256(reinterpret_cast<__m256i *>(p + i), z);
+    _mm_sfence();
+  }
+
+  // Benchmarks are registered during static initialization, before the CPU model is otherwise initialized.
+  bool cpu_init() {
+    __builtin_cpu_init();
+    return true;
+  }
+
+  void BM_zero(benchmark::State& state, void (*zero)(unsigned char *, std::size_t), bool supported) {
+    if (!supported) {
+      state.SkipWithError("CPU feature not supported");
+      return;
+    }
+    const std::size_t n = state.range(0);
+    for (auto _ : state) {
+      zero(buf, n);
+      benchmark::DoNotOptimize(buf);
+      benchmark::ClobberMemory();
+    }
+    state.SetBytesProcessed(state.iterations() * n);
+  }
+
+  void sizes(benchmark::internal::Benchmark *b) {
+    for (std::size_t n = 64; n <= max_size; n *= 4)
+      b->Arg(n);
+  }
+
+}
+
+BENCHMARK_CAPTURE(BM_zero, memset, zero_memset, cpu_init())->Apply(sizes);
+BENCHMARK_CAPTURE(BM_zero, rep_stosb, zero_rep_stosb, cpu_init())->Apply(sizes);
+BENCHMARK_CAPTURE(BM_zero, sse, zero_sse, cpu_init())->Apply(sizes);
+BENCHMARK_CAPTURE(BM_zero, avx, zero_avx, cpu_init() && __builtin_cpu_supports("avx"))->Apply(sizes);
+BENCHMARK_CAPTURE(BM_zero, avx512, zero_avx512, cpu_init() && __builtin_cpu_supports("avx512f"))->Apply(sizes);
+BENCHMARK_CAPTURE(BM_zero, nontemporal, zero_nontemporal, cpu_init() && __builtin_cpu_supports("avx"))->Apply(sizes);
+
+BENCHMARK_MAIN();
@@ -0,0 +1,28 @@
+#!/bin/bash
+
+usage() {
+    cat <<EOF
+usage: $0 base.s hardened.s
+Checks that every function in hardened.s has as many conditional jumps as in base.s, and that hardened.s contains
+SLH masking (the "slh.mask" inline asm markers emitted by HardenLoads).
+EOF
+}
+
+if [[ $# -ne 2 ]]; then
+    usage >&2
+    exit 1
+fi
+
+count_jccs() {
+    awk '/^[A-Za-z_][A-Za-z0-9_.$]*:/ { fn = $1 } $1 ~ /^j[a-z]+$/ && $1 != "jmp" && $1 != "jmpq" { n[fn]++ } END { for (fn in n) print fn, n[fn] }' "$1" | sort
+}
+
+if ! grep -q 'slh\.mask' "$2"; then
+    echo "$2: no loads were masked" >&2
+    exit 1
+fi
+
+if ! diff <(count_jccs "$1") <(count_jccs "$2"); then
+    echo "$2: SLH masking added conditional jumps (function, count: < base, > hardened)" >&2
+    exit 1
+fi
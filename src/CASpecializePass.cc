@@ -0,0 +1,185 @@
+#include <map>
+#include <vector>
+#include <algorithm>
+
+#include <llvm/Pass.h>
+#include <llvm/IR/Function.h>
+#include <llvm/IR/Module.h>
+#include <llvm/IR/InstrTypes.h>
+#include <llvm/Support/CommandLine.h>
+#include <llvm/Support/Debug.h>
+#include <llvm/Transforms/Utils/Cloning.h>
+
+#include "clou/util.h"
+#include "clou/analysis/ConstantAddressAnalysis.h"
+
+#define DEBUG_TYPE "llsct-ca-specialize"
+
+namespace clou {
+  namespace {
+
+    llvm::cl::opt<unsigned> MaxSize {
+      "clou-ca-specialize-max-size",
+      llvm::cl::desc("Maximum size (in instructions) of functions to specialize on constant-address arguments"),
+      llvm::cl::init(2000),
+    };
+
+    llvm::cl::opt<unsigned> MaxClones {
+      "clou-ca-specialize-max-clones",
+      llvm::cl::desc("Maximum number of constant-address specializations per function"),
+      llvm::cl::init(4),
+    };
+
+    llvm::cl::opt<double> MaxGrowth {
+      "clou-ca-specialize-max-growth",
+      llvm::cl::desc("Maximum module growth from constant-address specialization, as a fraction of the original module size"),
+      llvm::cl::init(0.5),
+    };
+
+    /* ConstantAddressAnalysis only marks a pointer argument constant-address if *every* call site passes a
+     * constant-address pointer, so a single caller passing a heap pointer pessimizes all others.
+     * This pass partitions the direct call sites of each direct-call-only function by the set of pointer
+     * arguments that are constant-address at that call site (its signature) and gives each signature that
+     * strictly improves on the callee's current constant-address arguments its own clone.
+     * Run it after DuplicatePass (so that external functions have direct-call-only copies) and before
+     * any pass that consumes ConstantAddressAnalysis.
+     */
+    struct CASpecializePass final : public llvm::ModulePass {
+      static inline char ID = 0;
+      CASpecializePass(): llvm::ModulePass(ID) {}
+
+      using Signature = std::vector<bool>;
+
+      struct Specialization {
+	llvm::Function *F;
+	Signature sig;
+	std::vector<llvm::CallBase *> calls;
+      };
+
+      static inline const char *suffix = ".llsct.ca";
+
+      void getAnalysisUsage(llvm::AnalysisUsage& AU) const override {
+	AU.addRequired<ConstantAddressAnalysis>();
+      }
+
+      static bool canSpecialize(const llvm::Function& F) {
+	if (F.isDeclaration() || F.isVarArg())
+	  return false;
+	if (!util::functionIsDirectCallOnly(F))
+	  return false;
+	if (F.getInstructionCount() > MaxSize)
+	  return false;
+	return llvm::any_of(F.args(), [] (const llvm::Argument& A) {
+	  return A.getType()->isPointerTy();
+	});
+      }
+
+      static Signature getSignature(const ConstantAddressAnalysis& CAA, const llvm::Function& F, const llvm::CallBase& C) {
+	Signature sig(F.arg_size(), false);
+	for (const llvm::Argument& A : F.args()) {
+	  const unsigned ArgNo = A.getArgNo();
+	  if (A.getType()->isPointerTy() && ArgNo < C.arg_size())
+	    sig[ArgNo] = CAA.isConstantAddress(C.getArgOperand(ArgNo));
+	}
+	return sig;
+      }
+
+      static void getSpecializations(const ConstantAddressAnalysis& CAA, llvm::Function& F, std::vector<Specialization>& out) {
+	const auto base_args = CAA.getConstAddrArgs(&F);
+	Signature base(F.arg_size(), false);
+	for (const llvm::Argument *A : base_args)
+	  base[A->getArgNo()] = true;
+
+	std::map<Signature, std::vector<llvm::CallBase *>> groups;
+	for (llvm::User *U : F.users()) {
+	  auto *C = llvm::dyn_cast<llvm::CallBase>(U);
+	  if (C == nullptr || C->getCalledFunction() != &F)
+	    continue;
+	  // Recursive calls stay on the original: their arguments are derived from the callee's own arguments.
+	  if (C->getFunction() == &F)
+	    continue;
+	  Signature sig = getSignature(CAA, F, *C);
+	  if (sig != base)
+	    groups[std::move(sig)].push_back(C);
+	}
+
+	// Prefer signatures shared by the most call sites, then those with the most constant-address arguments.
+	std::vector<Specialization> candidates;
+	for (auto& [sig, calls] : groups)
+	  candidates.push_back(Specialization {.F = &F, .sig = sig, .calls = std::move(calls)});
+	llvm::sort(candidates, [] (const Specialization& a, const Specialization& b) {
+	  if (a.calls.size() != b.calls.size())
+	    return a.calls.size() > b.calls.size();
+	  return std::count(a.sig.begin(), a.sig.end(), true) > std::count(b.sig.begin(), b.sig.end(), true);
+	});
+	if (candidates.size() > MaxClones)
+	  candidates.resize(MaxClones);
+	llvm::append_range(out, std::move(candidates));
+      }
+
+      static void specialize(const Specialization& S, unsigned idx) {
+	llvm::Function& F = *S.F;
+	LLVM_DEBUG({
+	  llvm::dbgs() << "Specializing " << F.getName() << " on constant-address arguments {";
+	  for (bool first = true; const llvm::Argument& A : F.args()) {
+	    if (S.sig[A.getArgNo()]) {
+	      if (!first)
+		llvm::dbgs() << ",";
+	      llvm::dbgs() << A.getArgNo();
+	      first = false;
+	    }
+	  }
+	  llvm::dbgs() << "} for " << S.calls.size() << " call sites\n";
+	});
+
+	llvm::ValueToValueMapTy VMap;
+	llvm::Function *NewF = llvm::CloneFunction(&F, VMap, nullptr);
+	NewF->setName(F.getName() + suffix + llvm::Twine(idx));
+	NewF->setLinkage(llvm::Function::InternalLinkage);
+
+	for (llvm::CallBase *C : S.calls)
+	  C->setCalledOperand(NewF);
+      }
+
+      bool runOnModule(llvm::Module& M) override {
+	const auto& CAA = getAnalysis<ConstantAddressAnalysis>();
+
+	unsigned module_size = 0;
+	for (const llvm::Function& F : M)
+	  module_size += F.getInstructionCount();
+	const unsigned budget = MaxGrowth * module_size;
+
+	// Plan all specializations before cloning anything: clones are not known to ConstantAddressAnalysis.
+	std::vector<Specialization> specializations;
+	for (llvm::Function& F : M)
+	  if (canSpecialize(F))
+	    getSpecializations(CAA, F, specializations);
+
+	// Spend the size budget on the specializations covering the most call sites first.
+	std::stable_sort(specializations.begin(), specializations.end(), [] (const Specialization& a, const Specialization& b) {
+	  return a.calls.size() > b.calls.size();
+	});
+
+	unsigned growth = 0;
+	std::map<const llvm::Function *, unsigned> clone_idx;
+	bool changed = false;
+	for (const Specialization& S : specializations) {
+	  const unsigned size = S.F->getInstructionCount();
+	  if (growth + size > budget)
+	    continue;
+	  growth += size;
+	  specialize(S, clone_idx[S.F]++);
+	  changed = true;
+	}
+	if (changed)
+	  CAA.clearCache();
+
+	return changed;
+      }
+    };
+
+    const llvm::RegisterPass<CASpecializePass> X {"llsct-ca-specialize", "LLSCT's Constant-Address Specialization Pass"};
+    const util::RegisterClangPass<CASpecializePass> Y;
+
+  }
+}
@@ -0,0 +1,75 @@
+#include <string>
+#include <vector>
+
+#include <llvm/Pass.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Bitcode/BitcodeWriter.h>
+#include <llvm/Support/CommandLine.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/Path.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include "clou/util.h"
+
+namespace clou {
+  namespace {
+
+    llvm::cl::opt<std::string> CaptureDir {
+      "llsct-capture-ir-dir",
+      llvm::cl::desc("Directory to write each module's bitcode to, as the LLSCT passes would see it (for bench/compile-bench.py)"),
+    };
+
+    /* Writes the module to <dir>/<last three components of its source path>.bc, which keeps identically-named sources
+     * in different directories apart while staying stable across build directories. The file is written under a unique
+     * name and renamed into place, since build systems may compile the same source more than once concurrently (e.g.,
+     * for shared and static libraries). */
+    struct CaptureIRPass final : public llvm::ModulePass {
+      static inline char ID = 0;
+      CaptureIRPass(): llvm::ModulePass(ID) {}
+
+      bool runOnModule(llvm::Module& M) override {
+	if (CaptureDir.getValue().empty())
+	  return false;
+
+	std::vector<llvm::StringRef> components;
+	for (auto it = llvm::sys::path::rbegin(M.getSourceFileName()), end = llvm::sys::path::rend(M.getSourceFileName());
+	     it != end && components.size() < 3 && *it != "/"; ++it)
+	  components.push_back(*it);
+
+	llvm::SmallString<128> path(CaptureDir.getValue());
+	for (llvm::StringRef component : llvm::reverse(components))
+	  llvm::sys::path::append(path, component);
+	path += ".bc";
+	if (const std::error_code ec = llvm::sys::fs::create_directories(llvm::sys::path::parent_path(path))) {
+	  llvm::errs() << "error: " << path << ": " << ec.message() << "\n";
+	  std::exit(EXIT_FAILURE);
+	}
+
+	int fd;
+	llvm::SmallString<128> tmp_path;
+	if (const std::error_code ec = llvm::sys::fs::createUniqueFile(path + ".%%%%%%.tmp", fd, tmp_path)) {
+	  llvm::errs() << "error: " << path << ": " << ec.message() << "\n";
+	  std::exit(EXIT_FAILURE);
+	}
+	{
+	  llvm::raw_fd_ostream os(fd, /*shouldClose*/true);
+	  llvm::WriteBitcodeToFile(M, os);
+	}
+	if (const std::error_code ec = llvm::sys::fs::rename(tmp_path, path)) {
+	  llvm::errs() << "error: " << path << ": " << ec.message() << "\n";
+	  std::exit(EXIT_FAILURE);
+	}
+
+	return false;
+      }
+
+      void getAnalysisUsage(llvm::AnalysisUsage& AU) const override {
+	AU.setPreservesAll();
+      }
+    };
+
+    const llvm::RegisterPass<CaptureIRPass> X {"llsct-capture-ir", "LLSCT's IR Capture Pass", false, true};
+    const util::RegisterClangPass<CaptureIRPass> Y;
+
+  }
+}
@@ -1,11 +1,35 @@
+#include <map>
+#include <numeric>
+
 #include <llvm/Pass.h>
+#include <llvm/ADT/BitVector.h>
 #include <llvm/IR/Instructions.h>
+#include <llvm/IR/IntrinsicInst.h>
+#include <llvm/IR/CFG.h>
+#include <llvm/Support/CommandLine.h>
 
 #include "clou/util.h"
 
 namespace clou {
   namespace {
 
+    llvm::cl::opt<bool> PackFrames {
+      "clou-frame-promotion-pack",
+      llvm::cl::desc("Pack the promoted allocas of each function into one frame global, overlapping slots with disjoint lifetimes"),
+      llvm::cl::init(false),
+    };
+
+    llvm::cl::opt<llvm::GlobalValue::ThreadLocalMode> ThreadLocalFrames {
+      "clou-frame-promotion-tls",
+      llvm::cl::desc("Allocate promoted frames in thread-local storage"),
+      llvm::cl::values(clEnumValN(llvm::GlobalValue::NotThreadLocal, "none", "Shared by all threads (not thread-safe)"),
+		       clEnumValN(llvm::GlobalValue::GeneralDynamicTLSModel, "general-dynamic", "General-dynamic TLS model"),
+		       clEnumValN(llvm::GlobalValue::LocalDynamicTLSModel, "local-dynamic", "Local-dynamic TLS model"),
+		       clEnumValN(llvm::GlobalValue::InitialExecTLSModel, "initial-exec", "Initial-exec TLS model"),
+		       clEnumValN(llvm::GlobalValue::LocalExecTLSModel, "local-exec", "Local-exec TLS model (executables only)")),
+      llvm::cl::init(llvm::GlobalValue::NotThreadLocal),
+    };
+
     struct FramePromotion final : public llvm::ModulePass {
       static inline char ID = 0;
       FramePromotion(): llvm::ModulePass(ID) {}
@@ -17,6 +41,8 @@ namespace clou {
 	    changed |= runOnFunction(F);
 	  }
 	}
+	if (changed && ThreadLocalFrames == llvm::GlobalValue::NotThreadLocal)
+	  util::markThreadUnsafe(M, "promoted frames are shared by all threads (-clou-frame-promotion-tls=none)");
 	return changed;
       }
       
@@ -30,11 +56,13 @@ namespace clou {
 	for (llvm::AllocaInst& AI : util::instructions<llvm::AllocaInst>(F))
 	  if (AI.isStaticAlloca())
 	    worklist.push_back(&AI);
+	if (PackFrames)
+	  return packFrame(F, worklist);
 	for (auto *AI : worklist) {
 	  if (AI->isStaticAlloca()) {
 	    llvm::Type *Ty = AI->getAllocatedType();
 	    llvm::GlobalVariable *GV = new llvm::GlobalVariable(M, Ty, false, llvm::GlobalVariable::InternalLinkage,
-								llvm::Constant::getNullValue(Ty));
+								llvm::Constant::getNullValue(Ty), "", nullptr, ThreadLocalFrames);
 	    GV->setAlignment(AI->getAlign());
 	    GV->setDSOLocal(true);
 	    AI->replaceAllUsesWith(GV);
@@ -44,6 +72,159 @@ namespace clou {
 	}
 	return changed;
       }
+
+      static llvm::AllocaInst *getLifetimeAlloca(const llvm::Instruction& I) {
+	if (const auto *II = llvm::dyn_cast<llvm::IntrinsicInst>(&I))
+	  if (II->isLifetimeStartOrEnd())
+	    return llvm::dyn_cast<llvm::AllocaInst>(II->getArgOperand(1)->stripPointerCasts());
+	return nullptr;
+      }
+
+      /* Computes which allocas may be live at the same time, using their lifetime markers (as in StackColoring).
+       * Allocas without lifetime markers are live throughout the function and interfere with all others.
+       */
+      static std::vector<llvm::BitVector> computeInterference(llvm::Function& F, llvm::ArrayRef<llvm::AllocaInst *> allocas) {
+	const unsigned n = allocas.size();
+	std::map<const llvm::AllocaInst *, unsigned> idx;
+	for (unsigned i = 0; i < n; ++i)
+	  idx[allocas[i]] = i;
+
+	llvm::BitVector marked(n);
+	for (llvm::Instruction& I : llvm::instructions(F))
+	  if (const llvm::AllocaInst *AI = getLifetimeAlloca(I))
+	    if (const auto it = idx.find(AI); it != idx.end())
+	      marked.set(it->second);
+
+	// Applies the lifetime markers of B to `live`, calling `on_start(i, live)` before each lifetime.start.
+	const auto transfer = [&] (llvm::BasicBlock& B, llvm::BitVector& live, auto on_start) {
+	  for (llvm::Instruction& I : B) {
+	    const llvm::AllocaInst *AI = getLifetimeAlloca(I);
+	    if (AI == nullptr)
+	      continue;
+	    const auto it = idx.find(AI);
+	    if (it == idx.end())
+	      continue;
+	    if (llvm::cast<llvm::IntrinsicInst>(I).getIntrinsicID() == llvm::Intrinsic::lifetime_start) {
+	      on_start(it->second, live);
+	      live.set(it->second);
+	    } else {
+	      live.reset(it->second);
+	    }
+	  }
+	};
+
+	// Forward may-live dataflow over the CFG.
+	std::map<llvm::BasicBlock *, llvm::BitVector> live_out;
+	for (llvm::BasicBlock& B : F)
+	  live_out[&B] = llvm::BitVector(n);
+	bool changed;
+	do {
+	  changed = false;
+	  for (llvm::BasicBlock& B : F) {
+	    llvm::BitVector live(n);
+	    for (llvm::BasicBlock *P : llvm::predecessors(&B))
+	      live |= live_out[P];
+	    transfer(B, live, [] (unsigned, const llvm::BitVector&) {});
+	    if (live != live_out[&B]) {
+	      live_out[&B] = live;
+	      changed = true;
+	    }
+	  }
+	} while (changed);
+
+	std::vector<llvm::BitVector> interfere(n, llvm::BitVector(n));
+	for (unsigned i = 0; i < n; ++i) {
+	  if (!marked.test(i)) {
+	    interfere[i].set();
+	    for (unsigned j = 0; j < n; ++j)
+	      interfere[j].set(i);
+	  }
+	}
+	for (llvm::BasicBlock& B : F) {
+	  llvm::BitVector live(n);
+	  for (llvm::BasicBlock *P : llvm::predecessors(&B))
+	    live |= live_out[P];
+	  transfer(B, live, [&] (unsigned i, const llvm::BitVector& live) {
+	    for (unsigned j : live.set_bits()) {
+	      interfere[i].set(j);
+	      interfere[j].set(i);
+	    }
+	  });
+	}
+	return interfere;
+      }
+
+      /* Replaces the static allocas of F with slots in a single per-function frame global `<fn>_frame`. Allocas with
+       * disjoint lifetimes may share bytes of the frame. Slots are placed largest-first at the lowest offset that does
+       * not overlap any interfering slot placed before.
+       */
+      bool packFrame(llvm::Function& F, llvm::ArrayRef<llvm::AllocaInst *> allocas) {
+	if (allocas.empty())
+	  return false;
+
+	llvm::Module& M = *F.getParent();
+	llvm::LLVMContext& ctx = M.getContext();
+	const llvm::DataLayout& DL = M.getDataLayout();
+	const unsigned n = allocas.size();
+	const std::vector<llvm::BitVector> interfere = computeInterference(F, allocas);
+
+	std::vector<uint64_t> sizes(n);
+	for (unsigned i = 0; i < n; ++i)
+	  sizes[i] = std::max<uint64_t>(allocas[i]->getAllocationSizeInBits(DL)->getFixedSize() / 8, 1);
+	std::vector<unsigned> order(n);
+	std::iota(order.begin(), order.end(), 0);
+	llvm::stable_sort(order, [&] (unsigned a, unsigned b) {
+	  return sizes[a] > sizes[b];
+	});
+
+	std::vector<uint64_t> offsets(n);
+	std::vector<unsigned> placed;
+	uint64_t frame_size = 0;
+	llvm::Align frame_align(1);
+	for (unsigned i : order) {
+	  const llvm::Align align = allocas[i]->getAlign();
+	  uint64_t offset = 0;
+	  bool moved;
+	  do {
+	    moved = false;
+	    for (unsigned j : placed) {
+	      if (interfere[i].test(j) && offset < offsets[j] + sizes[j] && offsets[j] < offset + sizes[i]) {
+		offset = llvm::alignTo(offsets[j] + sizes[j], align);
+		moved = true;
+	      }
+	    }
+	  } while (moved);
+	  offsets[i] = offset;
+	  placed.push_back(i);
+	  frame_size = std::max(frame_size, offset + sizes[i]);
+	  frame_align = std::max(frame_align, align);
+	}
+
+	llvm::Type *I8 = llvm::Type::getInt8Ty(ctx);
+	llvm::Type *frame_ty = llvm::ArrayType::get(I8, frame_size);
+	auto *frame = new llvm::GlobalVariable(M, frame_ty, false, llvm::GlobalVariable::InternalLinkage,
+					       llvm::Constant::getNullValue(frame_ty), F.getName() + "_frame", nullptr,
+					       ThreadLocalFrames);
+	frame->setAlignment(frame_align);
+	frame->setDSOLocal(true);
+
+	// Lifetime markers no longer delimit a private object once slots overlap, so drop them.
+	std::vector<llvm::Instruction *> markers;
+	for (llvm::Instruction& I : llvm::instructions(F))
+	  if (const llvm::AllocaInst *AI = getLifetimeAlloca(I); AI && llvm::is_contained(allocas, AI))
+	    markers.push_back(&I);
+	for (llvm::Instruction *I : markers)
+	  I->eraseFromParent();
+
+	llvm::Constant *base = llvm::ConstantExpr::getBitCast(frame, I8->getPointerTo());
+	for (unsigned i = 0; i < n; ++i) {
+	  llvm::AllocaInst *AI = allocas[i];
+	  llvm::Constant *slot = llvm::ConstantExpr::getInBoundsGetElementPtr(I8, base, llvm::ConstantInt::get(llvm::Type::getInt64Ty(ctx), offsets[i]));
+	  AI->replaceAllUsesWith(llvm::ConstantExpr::getBitCast(slot, AI->getType()));
+	  AI->eraseFromParent();
+	}
+	return true;
+      }
     };
 
     static llvm::RegisterPass<FramePromotion> X {"clou-frame-promition", "LLSCT's Frame Promotion Pass", false, false};
@@ -1,6 +1,7 @@
 #include <memory>
 #include <map>
 
+#include <llvm/ADT/BitVector.h>
 #include <llvm/IR/IRBuilder.h>
 #include <llvm/IR/PassManager.h>
 #include <llvm/Passes/PassBuilder.h>
@@ -17,6 +18,7 @@
 #include <llvm/IR/InstIterator.h>
 
 #include "clou/util.h"
+#include "clou/Zeroing.h"
 
 using namespace llvm;
 
@@ -28,23 +30,81 @@ namespace {
 
   const Align max_align (256); // TODO: make command-line parameter
 
+  cl::opt<GlobalValue::ThreadLocalMode> ThreadLocalStacks {
+    "clou-fps-tls",
+    cl::desc("Allocate function-local stacks in thread-local storage"),
+    cl::values(clEnumValN(GlobalValue::NotThreadLocal, "none", "Shared by all threads (not thread-safe)"),
+	       clEnumValN(GlobalValue::GeneralDynamicTLSModel, "general-dynamic", "General-dynamic TLS model"),
+	       clEnumValN(GlobalValue::LocalDynamicTLSModel, "local-dynamic", "Local-dynamic TLS model"),
+	       clEnumValN(GlobalValue::InitialExecTLSModel, "initial-exec", "Initial-exec TLS model"),
+	       clEnumValN(GlobalValue::LocalExecTLSModel, "local-exec", "Local-exec TLS model (executables only)")),
+    cl::init(GlobalValue::NotThreadLocal),
+  };
+
+  cl::opt<bool> RightSizeStacks {
+    "clou-fps-right-size",
+    cl::desc("Size function-local stacks of non-recursive functions to their worst-case call chain instead of "
+	     "-clou-stack-size"),
+    cl::init(false),
+  };
+
+  cl::opt<unsigned> FrameSlack {
+    "clou-fps-frame-slack",
+    cl::desc("Bytes reserved on right-sized function-local stacks for spills, callee-saved registers, and outgoing arguments"),
+    cl::init(1024),
+  };
+
+  cl::opt<unsigned> ExternalFrameBudget {
+    "clou-fps-external-frame",
+    cl::desc("Bytes reserved on right-sized function-local stacks for calls to code outside of the module (e.g., libc's "
+	     "memcpy and memset)"),
+    cl::init(4096),
+  };
+
+  cl::opt<unsigned> SignalSlack {
+    "clou-fps-signal-slack",
+    cl::desc("Bytes reserved on right-sized function-local stacks for signal handlers running on them"),
+    cl::init(8192), // SIGSTKSZ
+  };
+
+  cl::opt<bool> ShareStacks {
+    "clou-fps-share",
+    cl::desc("Share function-local stacks among non-recursive functions that are never live at the same time"),
+    cl::init(false),
+  };
+
   struct FunctionLocalStacks final: public ModulePass {
     static char ID;
 
     FunctionLocalStacks(): ModulePass(ID) {}
 
+    std::map<const Function *, uint64_t> stack_needs; // memoized getStackNeed
+    std::vector<std::pair<GlobalVariable *, Constant *>> tls_sps; // thread-local <fn>_sp and the end of <fn>_stack
+
     bool runOnModule(Module& M) override {
       if (!enabled.fps)
 	return false;
 
-      std::vector<GlobalVariable *> GVs;
+      std::vector<GlobalValue *> GVs;
+      stack_needs.clear();
+      tls_sps.clear();
+
+      std::map<const Function *, GlobalValue *> shared_stacks;
+      if (ShareStacks)
+	colorStacks(M, shared_stacks);
       
       for (Function& F : M) {
 	if (!F.isDeclaration()) {
-	  runOnFunction(F, std::back_inserter(GVs));
+	  runOnFunction(F, shared_stacks, std::back_inserter(GVs));
 	}
       }
 
+      if (!GVs.empty() && ThreadLocalStacks == GlobalValue::NotThreadLocal)
+	util::markThreadUnsafe(M, "function-local stacks are shared by all threads (-clou-fps-tls=none)");
+
+      if (!tls_sps.empty())
+	createEntryThunks(M);
+
       return true;
     }
 
@@ -60,8 +120,175 @@ namespace {
       return false;
     }
 
+    /* A non-recursive function has at most one activation at a time, so its function-local stack only needs to hold a
+     * single frame (its static allocas plus FrameSlack bytes for whatever the backend adds), the worst case along the
+     * call graph of what its callees need, and SignalSlack bytes for a signal handler interrupting the deepest of them.
+     * Code outside of the module (external and indirect callees, and the libc calls that memory intrinsics lower to)
+     * runs on this stack and is bounded by ExternalFrameBudget. Recursive functions and functions with dynamic allocas
+     * keep the full StackSize.
+     */
+    uint64_t getStackSize(Function& F) {
+      if (!RightSizeStacks)
+	return StackSize;
+      return std::min<uint64_t>(getStackNeed(F) + SignalSlack, StackSize);
+    }
+
+    uint64_t getStackNeed(Function& F) {
+      const auto [it, inserted] = stack_needs.emplace(&F, StackSize);
+      if (!inserted)
+	return it->second;
+      if (shouldRestoreOldSP(F))
+	return StackSize;
+
+      const DataLayout& DL = F.getParent()->getDataLayout();
+      uint64_t size = 0;
+      for (AllocaInst& AI : util::instructions<AllocaInst>(F)) {
+	if (!AI.isStaticAlloca())
+	  return StackSize;
+	size = alignTo(size, AI.getAlign()) + AI.getAllocationSizeInBits(DL)->getFixedSize() / 8;
+      }
+      uint64_t callee_size = 0;
+      for (CallBase& C : util::instructions<CallBase>(F)) {
+	if (C.isInlineAsm() || !util::mayLowerToFunctionCall(C))
+	  continue;
+	Function *Callee = util::getCalledFunction(&C);
+	if (Callee == nullptr || Callee->isDeclaration())
+	  callee_size = std::max<uint64_t>(callee_size, ExternalFrameBudget);
+	else
+	  callee_size = std::max(callee_size, getStackNeed(*Callee));
+      }
+      size = alignTo(size + FrameSlack, max_align) + callee_size;
+      return stack_needs[&F] = std::min<uint64_t>(size, StackSize);
+    }
+
+    /* Computes, for each defined function, the set of defined functions that may be called while it is live.
+     * Calls to declarations may re-enter the module through any function that is not direct-call-only.
+     */
+    static std::vector<BitVector> computeCallReachability(const std::vector<Function *>& functions) {
+      const unsigned n = functions.size();
+      std::map<const Function *, unsigned> idx;
+      for (unsigned i = 0; i < n; ++i)
+	idx[functions[i]] = i;
+
+      BitVector external(n);
+      for (unsigned i = 0; i < n; ++i)
+	if (!util::functionIsDirectCallOnly(*functions[i]))
+	  external.set(i);
+
+      std::vector<BitVector> callees(n, BitVector(n));
+      for (unsigned i = 0; i < n; ++i) {
+	for (const CallBase& C : util::instructions<CallBase>(*functions[i])) {
+	  if (isa<IntrinsicInst>(C) || C.isInlineAsm())
+	    continue;
+	  const auto *Callee = dyn_cast<Function>(C.getCalledOperand()->stripPointerCasts());
+	  const auto it = Callee ? idx.find(Callee) : idx.end();
+	  if (it != idx.end())
+	    callees[i].set(it->second);
+	  else
+	    callees[i] |= external;
+	}
+      }
+
+      std::vector<BitVector> reach(n, BitVector(n));
+      for (unsigned i = 0; i < n; ++i) {
+	std::vector<unsigned> todo;
+	for (unsigned j : callees[i].set_bits())
+	  todo.push_back(j);
+	reach[i] = callees[i];
+	while (!todo.empty()) {
+	  const unsigned j = todo.back();
+	  todo.pop_back();
+	  for (unsigned k : callees[j].set_bits()) {
+	    if (!reach[i].test(k)) {
+	      reach[i].set(k);
+	      todo.push_back(k);
+	    }
+	  }
+	}
+      }
+      return reach;
+    }
+
+    /* Assigns the function-local stacks of non-recursive functions to shared backing regions by greedy coloring of
+     * the interference graph, where two functions interfere if one may be called (transitively) while the other is live.
+     * Each function's <fn>_stack becomes an alias into its region, placed so that all stacks in a region end at the
+     * same address and the hot top-of-stack cache lines are shared.
+     * Functions that may run asynchronously (in a signal handler, or another thread) while any other function is live
+     * are never shared: those that are not direct-call-only (address-taken or externally visible), and everything they
+     * may call.
+     */
+    void colorStacks(Module& M, std::map<const Function *, GlobalValue *>& stacks) {
+      std::vector<Function *> functions;
+      for (Function& F : M)
+	if (!F.isDeclaration())
+	  functions.push_back(&F);
+      const std::vector<BitVector> reach = computeCallReachability(functions);
+
+      std::vector<unsigned> order;
+      std::vector<uint64_t> sizes(functions.size());
+      BitVector async(functions.size());
+      for (unsigned i = 0; i < functions.size(); ++i) {
+	if (!util::functionIsDirectCallOnly(*functions[i])) {
+	  async.set(i);
+	  async |= reach[i];
+	}
+      }
+
+      for (unsigned i = 0; i < functions.size(); ++i) {
+	if (shouldRestoreOldSP(*functions[i]) || async.test(i))
+	  continue;
+	order.push_back(i);
+	sizes[i] = getStackSize(*functions[i]);
+      }
+      llvm::stable_sort(order, [&] (unsigned a, unsigned b) {
+	return sizes[a] > sizes[b];
+      });
+
+      std::vector<std::vector<unsigned>> colors;
+      for (unsigned i : order) {
+	const auto it = llvm::find_if(colors, [&] (const std::vector<unsigned>& color) {
+	  return llvm::none_of(color, [&] (unsigned j) {
+	    return reach[i].test(j) || reach[j].test(i);
+	  });
+	});
+	if (it == colors.end())
+	  colors.push_back({i});
+	else
+	  it->push_back(i);
+      }
+
+      LLVMContext& ctx = M.getContext();
+      Type *I8 = Type::getInt8Ty(ctx);
+      const GlobalValue::ThreadLocalMode tls = ThreadLocalStacks;
+      unsigned num_regions = 0;
+      for (const std::vector<unsigned>& color : colors) {
+	if (color.size() < 2)
+	  continue;
+
+	// Members are sorted by decreasing size.
+	const uint64_t region_size = sizes[color.front()];
+	Type *region_ty = ArrayType::get(I8, region_size);
+	auto *region = new GlobalVariable(M, region_ty, false, GlobalValue::InternalLinkage, Constant::getNullValue(region_ty),
+					  "__llsct_fps_region" + std::to_string(num_regions++), nullptr, tls);
+	region->setDSOLocal(true);
+	region->setAlignment(max_align);
+
+	for (unsigned i : color) {
+	  Function& F = *functions[i];
+	  Type *stack_ty = ArrayType::get(I8, sizes[i]);
+	  Constant *base = ConstantExpr::getBitCast(region, I8->getPointerTo());
+	  Constant *addr = ConstantExpr::getInBoundsGetElementPtr(I8, base, ConstantInt::get(Type::getInt64Ty(ctx), region_size - sizes[i]));
+	  addr = ConstantExpr::getBitCast(addr, stack_ty->getPointerTo());
+	  auto *stack = GlobalAlias::create(stack_ty, 0, GlobalValue::InternalLinkage, (F.getName() + sep + "stack").str(), addr, &M);
+	  stack->setDSOLocal(true);
+	  stack->setThreadLocalMode(tls);
+	  stacks[&F] = stack;
+	}
+      }
+    }
+
     template <class OutputIt>
-    void runOnFunction(Function& F, OutputIt out) {
+    void runOnFunction(Function& F, const std::map<const Function *, GlobalValue *>& shared_stacks, OutputIt out) {
       // FIXME: Is this necessary?
       // YES!
       F.addFnAttr(Attribute::get(F.getContext(), "stackrealign"));
@@ -72,7 +299,7 @@ namespace {
       Module& M = *F.getParent();
 
       // Type:
-      Type *stack_ty = ArrayType::get(IntegerType::getInt8Ty(F.getContext()), StackSize);
+      Type *stack_ty = ArrayType::get(IntegerType::getInt8Ty(F.getContext()), getStackSize(F));
       Type *sp_ty = PointerType::get(IntegerType::getInt8Ty(F.getContext()), 0);
       const auto stack_name = (F.getName() + sep + "stack").str();
       const auto sp_name = (F.getName() + sep + "sp").str();
@@ -80,19 +307,29 @@ namespace {
       // determine correct linkage
       GlobalVariable::LinkageTypes linkage = GlobalVariable::LinkageTypes::InternalLinkage;
 
-      GlobalVariable *stack = new GlobalVariable(M, stack_ty, false, linkage, Constant::getNullValue(stack_ty), stack_name, nullptr, GlobalValue::NotThreadLocal);
-      GlobalVariable *sp = new GlobalVariable(M,
-					      sp_ty,
-					      false,
-					      linkage,
-					      ConstantExpr::getBitCast(ConstantExpr::getGetElementPtr(stack_ty, stack,
-												      Constant::getIntegerValue(Type::getInt8Ty(M.getContext()),
-																APInt(8, 1))),
-								       sp_ty),
-					      sp_name, nullptr, GlobalValue::NotThreadLocal);
+      // The address of a thread-local variable is not a link-time constant, not even in the TLS initialization image,
+      // so a thread-local stack pointer starts out null and is pointed at the end of this thread's stack when the
+      // thread first enters the module (see createEntryThunks).
+      const GlobalValue::ThreadLocalMode tls = ThreadLocalStacks;
+
+      GlobalValue *stack;
+      if (const auto it = shared_stacks.find(&F); it != shared_stacks.end()) {
+	stack = it->second;
+      } else {
+	auto *GV = new GlobalVariable(M, stack_ty, false, linkage, Constant::getNullValue(stack_ty), stack_name, nullptr, tls);
+	GV->setAlignment(max_align);
+	stack = GV;
+      }
+      Constant *stack_end = ConstantExpr::getBitCast(ConstantExpr::getGetElementPtr(stack_ty, stack,
+										     Constant::getIntegerValue(Type::getInt8Ty(M.getContext()),
+													       APInt(8, 1))),
+						      sp_ty);
+      Constant *sp_init = (tls == GlobalValue::NotThreadLocal) ? stack_end : Constant::getNullValue(sp_ty);
+      GlobalVariable *sp = new GlobalVariable(M, sp_ty, false, linkage, sp_init, sp_name, nullptr, tls);
+      if (tls != GlobalValue::NotThreadLocal)
+	tls_sps.emplace_back(sp, stack_end);
       stack->setDSOLocal(true);
       sp->setDSOLocal(true);
-      stack->setAlignment(max_align);
       sp->setAlignment(Align(8)); // TODO: actually compute size of pointer?
 
       *out++ = stack;
@@ -132,6 +369,82 @@ namespace {
 
     }
 
+    /* Creates __llsct_fps_init_thread, which points each thread-local <fn>_sp at the end of this thread's <fn>_stack and
+     * then sets the thread-local flag ready.
+     */
+    Function *createThreadInit(Module& M, GlobalVariable *ready) {
+      LLVMContext& ctx = M.getContext();
+      Type *I8 = Type::getInt8Ty(ctx);
+      auto *init = Function::Create(FunctionType::get(Type::getVoidTy(ctx), false), GlobalValue::InternalLinkage,
+				    "__llsct_fps_init_thread", M);
+      init->addFnAttr(Attribute::NoInline);
+      init->addFnAttr(Attribute::Cold);
+      IRBuilder<> IRB(BasicBlock::Create(ctx, "", init));
+      for (const auto& [sp, stack_end] : tls_sps)
+	IRB.CreateStore(stack_end, sp);
+      // Set last, so that a signal handler interrupting this function initializes the stacks again.
+      IRB.CreateStore(ConstantInt::get(I8, 1), ready);
+      IRB.CreateRetVoid();
+      return init;
+    }
+
+    /* With thread-local stacks, every function that may be entered from outside the module (on a new thread, or
+     * through a callback) gets an entry thunk that takes over its name, linkage and address-taken uses. The thunk has no
+     * function-local stack of its own, so the backend leaves its stack pointer alone. It initializes the thread's stacks
+     * if it is the thread's first entry into the module, and then tail-calls the function, whose prologue can thus rely
+     * on <fn>_sp being set up. Direct calls within the module still go to the function itself.
+     */
+    void createEntryThunks(Module& M) {
+      LLVMContext& ctx = M.getContext();
+      std::vector<Function *> entries;
+      for (Function& F : M)
+	if (!F.isDeclaration() && !util::functionIsDirectCallOnly(F))
+	  entries.push_back(&F);
+
+      Type *I8 = Type::getInt8Ty(ctx);
+      auto *ready = new GlobalVariable(M, I8, false, GlobalValue::InternalLinkage, ConstantInt::get(I8, 0),
+				       "__llsct_fps_ready", nullptr, ThreadLocalStacks);
+      ready->setDSOLocal(true);
+      Function *init = createThreadInit(M, ready);
+
+      for (Function *F : entries) {
+	Function *thunk = Function::Create(F->getFunctionType(), F->getLinkage(), F->getAddressSpace(), "", &M);
+	thunk->copyAttributesFrom(F);
+	thunk->setComdat(F->getComdat());
+	thunk->removeFnAttr("stackrealign");
+	thunk->removeFnAttr(FnAttr_fps_usestack);
+	thunk->takeName(F);
+	F->setName(thunk->getName() + sep + "fps");
+	F->setLinkage(GlobalValue::InternalLinkage);
+	F->replaceUsesWithIf(thunk, [] (Use& U) {
+	  const auto *C = dyn_cast<CallBase>(U.getUser());
+	  return C == nullptr || !C->isCallee(&U);
+	});
+
+	BasicBlock *entry = BasicBlock::Create(ctx, "", thunk);
+	BasicBlock *slow = BasicBlock::Create(ctx, "", thunk);
+	BasicBlock *call = BasicBlock::Create(ctx, "", thunk);
+	IRBuilder<> IRB(entry);
+	Value *is_ready = IRB.CreateIsNotNull(IRB.CreateLoad(ready->getValueType(), ready));
+	IRB.CreateCondBr(is_ready, call, slow);
+	IRB.SetInsertPoint(slow);
+	IRB.CreateCall(init);
+	IRB.CreateBr(call);
+	IRB.SetInsertPoint(call);
+	std::vector<Value *> args;
+	for (Argument& A : thunk->args())
+	  args.push_back(&A);
+	CallInst *C = IRB.CreateCall(F, args);
+	C->setCallingConv(F->getCallingConv());
+	C->setAttributes(F->getAttributes().removeFnAttributes(ctx));
+	C->setTailCallKind(CallInst::TCK_MustTail);
+	if (C->getType()->isVoidTy())
+	  IRB.CreateRetVoid();
+	else
+	  IRB.CreateRet(C);
+      }
+    }
+
     CallInst *findCallToFunction(Function& F, StringRef name) {
       for (BasicBlock& B : F) {
 	for (Instruction& I : B) {
@@ -217,7 +530,7 @@ namespace {
       Value *sizeDiffOrZero = postIRB.CreateSelect(sizeCmp, sizeDiff, Constant::getNullValue(Type::getInt64Ty(ctx)));
       Value *gep = postIRB.CreateInBoundsGEP(reallocPtr->getType()->getPointerElementType(), reallocPtr,
 					     std::vector<Value *> {oldSize});
-      postIRB.CreateMemSet(gep, Constant::getNullValue(Type::getInt8Ty(ctx)), sizeDiffOrZero, MaybeAlign(16));
+      CreateZero(postIRB, gep, sizeDiffOrZero, MaybeAlign(16), /*isVolatile*/false);
     }
 
     void replaceMemoryRealloc(Module& M, StringRef realName) {
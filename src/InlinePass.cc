@@ -1,4 +1,6 @@
 #include <map>
+#include <optional>
+#include <queue>
 #include <set>
 #include <stack>
 
@@ -6,8 +8,14 @@
 #include <llvm/IR/Function.h>
 #include <llvm/IR/Attributes.h>
 #include <llvm/Transforms/Utils/Cloning.h>
+#include <llvm/Transforms/Utils/CodeExtractor.h>
+#include <llvm/IR/Dominators.h>
+#include <llvm/ADT/DepthFirstIterator.h>
+#include <llvm/ADT/PostOrderIterator.h>
 #include <llvm/IR/IntrinsicsX86.h>
-#include <llvm/Analysis/CallGraphSCCPass.h>
+#include <llvm/Analysis/CallGraph.h>
+#include <llvm/ADT/SCCIterator.h>
+#include <llvm/Support/CommandLine.h>
 
 #include "clou/util.h"
 #include "clou/analysis/SpeculativeTaintAnalysis.h"
@@ -16,181 +24,275 @@
 #include "clou/analysis/NonspeculativeTaintAnalysis.h"
 #include "clou/analysis/ConstantAddressAnalysis.h"
 #include "clou/Mitigation.h"
+#include "clou/Metadata.h"
 
 namespace clou {
   namespace {
 
-#if 1
-    struct InlinePass final : public llvm::FunctionPass {
+    llvm::cl::opt<unsigned> FenceCost {
+      "clou-inline-fence-cost",
+      llvm::cl::desc("Estimated cost of a fence, in instructions, when weighing the benefit of inlining"),
+      llvm::cl::init(40),
+    };
+
+    llvm::cl::opt<float> MaxCallerGrowth {
+      "clou-inline-max-caller-growth",
+      llvm::cl::desc("Maximum size of a function after inlining, as a multiple of its original size"),
+      llvm::cl::init(4),
+    };
+
+    llvm::cl::opt<float> MaxModuleGrowth {
+      "clou-inline-max-module-growth",
+      llvm::cl::desc("Maximum growth of the module due to inlining, as a fraction of its original size"),
+      llvm::cl::init(0.5),
+    };
+
+    llvm::cl::opt<bool> PartialInline {
+      "clou-inline-partial",
+      llvm::cl::desc("Outline the code of large functions with NCAS->RET hazards that no NCA store reaches, so that callers can inline the rest"),
+      llvm::cl::init(false),
+    };
+
+    llvm::cl::opt<unsigned> MinOutlineSize {
+      "clou-inline-partial-min-outline",
+      llvm::cl::desc("Minimum size (in instructions) of a region outlined for partial inlining"),
+      llvm::cl::init(16),
+    };
+
+    /* Bottom-up inlining to remove fences caused by secret NCA stores reaching calls (NCAS->CALL) or returns (NCAS->RET).
+     *
+     * Functions are visited in post-order of the call graph's SCCs, so callees are final (and summarized) before their
+     * callers are visited. The taint and leak analyses are run once per function, before anything is inlined into it:
+     * candidate calls are ranked, and no decision is made from analysis results that an inline has made stale. Facts
+     * about an inlined region come from the callee's summary instead of re-analysis: each function's calls are flagged
+     * (md::nca_call, md::entry_call) with whether its NCA stores, or its entry, reach them, and the flags are carried
+     * into the caller by cloning, where the calls become candidates too.
+     *
+     * This is a ModulePass rather than a CallGraphSCCPass because the legacy pass manager only provides function
+     * analyses on demand (getAnalysis<T>(F)) to module passes.
+     */
+    struct InlinePass final : public llvm::ModulePass {
       static inline char ID = 0;
-      InlinePass(): llvm::FunctionPass(ID) {}
+      InlinePass(): llvm::ModulePass(ID) {}
+
+      /* An inlining candidate. Inlining a call that an NCA store reaches removes the NCAS->CALL fence before it;
+       * inlining a callee with an NCAS->RET hazard additionally lets the caller cover the fence at the callee's return.
+       * The cost is the number of instructions added, which is also what the min-cut graph grows by.
+       */
+      struct Candidate {
+	llvm::CallBase *CB;
+	llvm::Function *Callee;
+	unsigned benefit; // estimated fences saved
+	unsigned cost; // instructions added
 
-      using CBSet = std::set<llvm::CallBase *>;
+	bool profitable() const {
+	  return benefit * FenceCost >= cost;
+	}
+
+	bool operator<(const Candidate& o) const {
+	  return static_cast<uint64_t>(benefit) * o.cost < static_cast<uint64_t>(o.benefit) * cost;
+	}
+      };
 
-      static inline constexpr unsigned inline_limit = 100; // per-function inline limit
-      std::map<const llvm::Function *, unsigned> inline_counts; // inline counts per function
+      /* Per-function summary, computed after inlining into the function. The calls that its NCA stores or its entry
+       * reach are flagged with md::nca_call and md::entry_call.
+       */
+      struct Summary {
+	bool ret_hazard = false; // an NCA store may reach a return, so callers would benefit from inlining this function
+	bool entry_ret = false; // the entry may reach a return, so an NCA store reaching a call to it reaches past it
+      };
+
+      std::map<const llvm::Function *, Summary> summaries;
+      unsigned module_budget; // instructions that may still be added to the module by inlining
 
       void getAnalysisUsage(llvm::AnalysisUsage& AU) const override {
+	AU.addRequired<llvm::CallGraphWrapperPass>();
 	AU.addRequired<ConstantAddressAnalysis>();
 	AU.addRequired<NonspeculativeTaint>();
 	AU.addRequired<SpeculativeTaint>();
 	AU.addRequired<LeakAnalysis>();
       }
 
-      std::set<llvm::StoreInst *> compute_nca_stores(llvm::Function& F) {
-	auto& CAA = getAnalysis<ConstantAddressAnalysis>();
-	auto& NST = getAnalysis<NonspeculativeTaint>();
-	auto& ST = getAnalysis<SpeculativeTaint>();
+      /* Analysis results for a single function. */
+      struct Analyses {
+	ConstantAddressAnalysis& CAA;
+	NonspeculativeTaint& NST;
+	SpeculativeTaint& ST;
+	LeakAnalysis& LA;
+      };
+
+      Analyses getAnalyses(llvm::Function& F) {
+	// NOTE: Each on-the-fly request re-runs all function analyses on F, so request each once.
+	auto& NST = getAnalysis<NonspeculativeTaint>(F);
+	auto& ST = getAnalysis<SpeculativeTaint>(F);
+	auto& LA = getAnalysis<LeakAnalysis>(F);
+	return Analyses {.CAA = getAnalysis<ConstantAddressAnalysis>(), .NST = NST, .ST = ST, .LA = LA};
+      }
+
+      static std::set<llvm::StoreInst *> compute_nca_stores(llvm::Function& F, Analyses& A) {
 	std::set<llvm::StoreInst *> stores;
 	for (llvm::StoreInst& SI : util::instructions<llvm::StoreInst>(F)) {
 	  llvm::Value *PtrOp = SI.getPointerOperand();
 	  llvm::Value *ValOp = SI.getValueOperand();
-	  if (!CAA.isConstantAddress(PtrOp) && (NST.secret(ValOp) || ST.secret(ValOp)))
+	  if (!A.CAA.isConstantAddress(PtrOp) && (A.NST.secret(ValOp) || A.ST.secret(ValOp)))
 	    stores.insert(&SI);
 	}
 	return stores;
-      }      
-
-      bool calleeWouldBenefitFromInlining(llvm::Function& F) {
-	auto& LA = getAnalysis<LeakAnalysis>();
-	auto& NST = getAnalysis<NonspeculativeTaint>();
-	auto& ST = getAnalysis<SpeculativeTaint>();
-	
-	// Check if there's a NCAS-RET.
-	std::stack<llvm::Instruction *> todo;
-	std::set<llvm::Instruction *> seen;
-	for (llvm::StoreInst *SI : compute_nca_stores(F))
-	  todo.push(SI);
-	while (!todo.empty()) {
-	  auto *I = todo.top();
-	  todo.pop();
-	  if (!seen.insert(I).second)
-	    continue;
-
-	  if (llvm::isa<llvm::ReturnInst>(I))
-	    return true;
-
-	  if (LA.mayLeak(I) && (NST.secret(I) || ST.secret(I)))
-	    continue;
-
-	  if (auto *C = llvm::dyn_cast<llvm::CallBase>(I))
-	    if (util::mayLowerToFunctionCall(*C))
-	      continue;
-
-	  for (auto *succ : llvm::successors_inst(I))
-	    todo.push(succ);
-	}
-	return false;
       }
 
-      llvm::CallBase *handleSecretStore(llvm::StoreInst *SI, const CBSet& skip) {
-	// check if we encounter any public loads along the way
-	auto& ST = getAnalysis<SpeculativeTaint>();
-	auto& LA = getAnalysis<LeakAnalysis>();
-
-	std::set<llvm::Instruction *> seen;
+      /* Explores forward from seeds until a leaking public load or a call. Collects the calls reached and returns
+       * whether a return is reached. Instructions inlined since A was computed have no facts, so exploration continues
+       * through their loads.
+       */
+      static bool explore(Analyses& A, const std::vector<llvm::Instruction *>& seeds, std::set<llvm::CallBase *>& calls,
+			  std::set<llvm::Instruction *>& seen) {
+	bool ret_reached = false;
 	std::stack<llvm::Instruction *> todo;
-	todo.push(SI);
+	for (llvm::Instruction *I : seeds)
+	  todo.push(I);
 	while (!todo.empty()) {
 	  llvm::Instruction *I = todo.top();
 	  todo.pop();
-
 	  if (!seen.insert(I).second)
 	    continue;
 
-	  // Handle if call.
+	  if (llvm::isa<llvm::ReturnInst>(I)) {
+	    ret_reached = true;
+	    continue;
+	  }
+
 	  if (auto *CB = llvm::dyn_cast<llvm::CallBase>(I)) {
 	    if (util::mayLowerToFunctionCall(*CB)) {
-	      if (const auto *CalledF = util::getCalledFunction(CB)) {
-		if (CalledF->isDeclaration()) {
-		  continue; // Stop exploring this path, since we have an external call.
-		} else if (skip.contains(CB)) {
-		  continue; // Stop exploring this path, since we have already been unable to handle this call.
-		} else {
-		  // Return this call as candidate for inlining.
-		  return CB;
-		}
-	      } else {
-		continue; // Stop exploring this path, since it looks like an indirect call.
-	      }
+	      calls.insert(CB);
+	      continue;
 	    }
 	  }
 
-	  // Handle loads.
-	  if (auto *LI = llvm::dyn_cast<llvm::LoadInst>(I)) {
-	    if (!ST.secret(LI) && LA.mayLeak(LI)) {
-	      // stop exploring this path
+	  if (auto *LI = llvm::dyn_cast<llvm::LoadInst>(I))
+	    if (!A.ST.secret(LI) && A.LA.mayLeak(LI))
 	      continue;
-	    }
-	  }
 
-	  // Continue exploring paths.
-	  for (auto *succ : llvm::successors_inst(I)) {
+	  for (auto *succ : llvm::successors_inst(I))
 	    todo.push(succ);
-	  }
 	}
-	return nullptr;
+	return ret_reached;
       }
 
-      llvm::CallBase *getCallToInline(llvm::Function& F, CBSet& skip) {
-	auto& ST = getAnalysis<SpeculativeTaint>();
-	auto& NST = getAnalysis<NonspeculativeTaint>();
-	const auto& CAA = getAnalysis<ConstantAddressAnalysis>();
-
-	for (llvm::Instruction& I : llvm::instructions(F)) {
-	  if (llvm::isa<llvm::CallBase>(&I)) {
-	    // ignore
-	    // TODO: handle intrinsics properly
-	  } else if (auto *SI = llvm::dyn_cast<llvm::StoreInst>(&I)) {
-	    llvm::Value *V = SI->getValueOperand();
-	    if (!CAA.isConstantAddress(SI->getPointerOperand()) && (NST.secret(V) || ST.secret(V)))
-	      if (llvm::CallBase *CB = handleSecretStore(SI, skip))
-		return CB;
-	  }
-	}
+      /* Explores forward from each NCA store. Collects the calls reached (NCAS->CALL) and returns whether a return is
+       * reached (NCAS->RET).
+       */
+      static bool explore_nca_stores(llvm::Function& F, Analyses& A, std::set<llvm::CallBase *>& calls,
+				     std::set<llvm::Instruction *>& seen) {
+	const std::set<llvm::StoreInst *> stores = compute_nca_stores(F, A);
+	return explore(A, std::vector<llvm::Instruction *>(stores.begin(), stores.end()), calls, seen);
+      }
 
-	for (llvm::CallBase& C : util::instructions<llvm::CallBase>(F)) {
-	  if (skip.contains(&C))
-	    continue;
-	  auto *F = util::getCalledFunction(&C);
-	  if (F == nullptr || F->isDeclaration())
-	    continue;
-	  if (calleeWouldBenefitFromInlining(*F) && false)
-	    return &C;
-	}
-	
-	return nullptr;
+      bool hasRetHazard(const llvm::Function *F) const {
+	const auto it = summaries.find(F);
+	return it != summaries.end() && it->second.ret_hazard;
       }
 
-      bool doInitialization(llvm::Module& M) override {
-	inline_counts.clear();
-	return false;
+      std::optional<Candidate> getCandidate(llvm::CallBase& C, const std::set<llvm::CallBase *>& nca_calls,
+					    const std::set<llvm::Function *>& scc) {
+	llvm::Function *Callee = util::getCalledFunction(&C);
+	if (Callee == nullptr || Callee->isDeclaration() || scc.contains(Callee))
+	  return std::nullopt;
+	const unsigned benefit = (nca_calls.contains(&C) ? 1 : 0) + (hasRetHazard(Callee) ? 1 : 0);
+	if (benefit == 0)
+	  return std::nullopt;
+	const Candidate candidate = {.CB = &C, .Callee = Callee, .benefit = benefit, .cost = Callee->getInstructionCount()};
+	if (!candidate.profitable())
+	  return std::nullopt;
+	return candidate;
       }
 
-      bool runOnFunction(llvm::Function& F) override {
-	llvm::CallBase *CB;
-	std::set<llvm::CallBase *> skip;
+      /* The instruction that control reaches right after returning from CB. */
+      static llvm::Instruction *getContinuation(llvm::CallBase *CB) {
+	if (auto *II = llvm::dyn_cast<llvm::InvokeInst>(CB))
+	  return &II->getNormalDest()->front();
+	return CB->getNextNode();
+      }
+
+      bool runOnFunction(llvm::Function& F, const std::set<llvm::Function *>& scc) {
+	Analyses A = getAnalyses(F);
+	std::set<llvm::CallBase *> nca_calls, entry_calls;
+	std::set<llvm::Instruction *> explored, entry_explored;
+	Summary& summary = summaries[&F];
+	summary.ret_hazard = explore_nca_stores(F, A, nca_calls, explored);
+	summary.entry_ret = explore(A, {&F.getEntryBlock().front()}, entry_calls, entry_explored);
+
+	// Candidates are ranked using F's analyses before anything is inlined into it; the calls in inlined regions
+	// are ranked using the callees' summaries as they appear.
+	std::priority_queue<Candidate> candidates;
+	for (llvm::CallBase& C : util::instructions<llvm::CallBase>(F))
+	  if (const auto candidate = getCandidate(C, nca_calls, scc))
+	    candidates.push(*candidate);
+
 	bool changed = false;
-	unsigned& inline_count = inline_counts[&F];
-	while ((CB = getCallToInline(F, skip))) {
-	  if (inline_count >= inline_limit)
-	    break;
-	  assert(!skip.contains(CB));
-	  llvm::Function *CalledF = util::getCalledFunction(CB);
-	  if (CalledF == nullptr || CalledF->isDeclaration() || CalledF == &F) {
-	    skip.insert(CB);
+	bool inlined_into = false;
+	unsigned size = F.getInstructionCount();
+	const unsigned max_size = MaxCallerGrowth * size;
+	for (; !candidates.empty(); candidates.pop()) {
+	  const Candidate candidate = candidates.top();
+	  if (size + candidate.cost > max_size || candidate.cost > module_budget)
 	    continue;
-	  }
+	  llvm::Instruction *Continuation = getContinuation(candidate.CB);
+	  const bool nca_reached = nca_calls.contains(candidate.CB);
+	  const bool entry_reached = entry_calls.contains(candidate.CB);
 	  llvm::InlineFunctionInfo IFI;
-	  const auto result = llvm::InlineFunction(*CB, IFI);
-	  if (!result.isSuccess()) {
-	    skip.insert(CB);
+	  const auto result = llvm::InlineFunction(*candidate.CB, IFI);
+	  if (!result.isSuccess())
 	    continue;
+	  // The call is gone, and its address may be reused.
+	  nca_calls.erase(candidate.CB);
+	  entry_calls.erase(candidate.CB);
+	  explored.erase(candidate.CB);
+	  entry_explored.erase(candidate.CB);
+	  // Inlining replaces the uses of the call's result in place.
+	  A.CAA.clearCache();
+	  inlined_into = true;
+	  size += candidate.cost;
+	  module_budget -= candidate.cost;
+	  // The inlined region may carry the callee's NCAS->RET hazard to F's returns.
+	  summary.ret_hazard |= hasRetHazard(candidate.Callee);
+
+	  // Whatever reached the call now reaches the calls that the callee's entry reaches, and, if the callee may
+	  // return, the code after the call. The callee's own NCA stores reach their calls as before.
+	  std::set<llvm::CallBase *> new_calls(IFI.InlinedCallSites.begin(), IFI.InlinedCallSites.end());
+	  for (llvm::CallBase *NC : IFI.InlinedCallSites) {
+	    const bool from_entry = md::getMetadataFlag(NC, md::entry_call);
+	    if (md::getMetadataFlag(NC, md::nca_call) || (nca_reached && from_entry))
+	      nca_calls.insert(NC);
+	    if (entry_reached && from_entry)
+	      entry_calls.insert(NC);
+	  }
+	  const auto it = summaries.find(candidate.Callee);
+	  if (it != summaries.end() && it->second.entry_ret) {
+	    if (nca_reached) {
+	      std::set<llvm::CallBase *> calls;
+	      summary.ret_hazard |= explore(A, {Continuation}, calls, explored);
+	      nca_calls.insert(calls.begin(), calls.end());
+	      new_calls.insert(calls.begin(), calls.end());
+	    }
+	    if (entry_reached)
+	      summary.entry_ret |= explore(A, {Continuation}, entry_calls, entry_explored);
 	  }
-	  inline_count += inline_counts[CalledF] + 1;
+	  for (llvm::CallBase *NC : new_calls)
+	    if (const auto new_candidate = getCandidate(*NC, nca_calls, scc))
+	      candidates.push(*new_candidate);
 	  changed = true;
 	}
 
+	// Summarize F for its callers, replacing the flags cloned from its callees.
+	for (llvm::CallBase& C : util::instructions<llvm::CallBase>(F)) {
+	  C.setMetadata(md::nca_call, nullptr);
+	  C.setMetadata(md::entry_call, nullptr);
+	}
+	for (llvm::CallBase *C : nca_calls)
+	  md::setMetadataFlag(C, md::nca_call);
+	for (llvm::CallBase *C : entry_calls)
+	  md::setMetadataFlag(C, md::entry_call);
+
 	// We'll also erase any mitigations that have been introduced.
 	std::vector<MitigationInst *> mitigations;
 	for (MitigationInst& I : util::instructions<MitigationInst>(F))
@@ -200,176 +302,111 @@ namespace clou {
 	  I->eraseFromParent();
 
 	assert(llvm::none_of(llvm::instructions(F), [] (const llvm::Instruction& I) {
-	  if (const auto *II = llvm::dyn_cast<llvm::IntrinsicInst>(&I))
-	    return II->getIntrinsicID() == llvm::Intrinsic::x86_sse2_lfence;
-	  else
-	    return false;
+	  return llvm::isa<MitigationInst>(&I);
 	}));
+
+	// If F is too large to be inlined whole, shrink it to its hazard region so that its callers can inline that.
+	if (PartialInline && summary.ret_hazard && !F.use_empty() && F.getInstructionCount() > 2 * FenceCost) {
+	  if (inlined_into) {
+	    // The analyses predate the inlining into F, so rerun them to cover the inlined code.
+	    Analyses A = getAnalyses(F);
+	    nca_calls.clear();
+	    explored.clear();
+	    explore_nca_stores(F, A, nca_calls, explored);
+	  }
+	  changed |= outlineColdRegions(F, explored);
+	}
 	
 	return changed;
       }
-    };
-
-#else
-    
-    struct InlinePass final : public llvm::CallGraphSCCPass {
-      static inline char ID = 0;
-      InlinePass(): llvm::CallGraphSCCPass(ID) {}
 
-      void getAnalysisUsage(llvm::AnalysisUsage& AU) const override {
-	AU.addRequired<ConstantAddressAnalysis>();
-	AU.addRequired<SpeculativeTaint>();
-	AU.addRequired<NonspeculativeTaint>();
-	AU.addRequired<LeakAnalysis>();
-      }
-
-      std::set<llvm::Function *> callees_to_inline; // Functions that would benefit from inlining.
-      std::set<llvm::Function *> inlinable; // Functions that we've processed so far.
-
-      std::set<llvm::StoreInst *> compute_nca_stores(llvm::Function& F) {
-	auto& CAA = getAnalysis<ConstantAddressAnalysis>(F);
-	auto& NST = getAnalysis<NonspeculativeTaint>(F);
-	auto& ST = getAnalysis<SpeculativeTaint>(F);
-	std::set<llvm::StoreInst *> stores;
-	for (llvm::StoreInst& SI : util::instructions<llvm::StoreInst>(F)) {
-	  llvm::Value *PtrOp = SI.getPointerOperand();
-	  llvm::Value *ValOp = SI.getValueOperand();
-	  if (!CAA.isConstantAddress(PtrOp) && (NST.secret(ValOp) || ST.secret(ValOp)))
-	    stores.insert(&SI);
-	}
-	return stores;
-      }
-      
-      bool runOnSCC(llvm::CallGraphSCC& SCC) override {
-	if (llvm::all_of(SCC, [] (llvm::CallGraphNode *CGN) {
-	  return CGN->getFunction() == nullptr;
-	})) {
-	  return false;
+      /* Partial inlining: outlines the parts of F that no NCA store reaches into separate functions, leaving F as
+       * a small wrapper around its NCAS->RET hazard region. Regions are the maximal dominator subtrees that contain
+       * no explored instruction and are not the entry block; since exploration is closed under successors, an NCA store
+       * never reaches the outlined code, and the outlined function has no NCAS->RET hazard of its own.
+       */
+      bool outlineColdRegions(llvm::Function& F, const std::set<llvm::Instruction *>& explored) {
+	std::set<llvm::BasicBlock *> hot;
+	for (llvm::Instruction *I : explored)
+	  hot.insert(I->getParent());
+
+	llvm::DominatorTree DT(F);
+	std::map<llvm::BasicBlock *, bool> cold; // whether B's dominator subtree is entirely cold
+	std::map<llvm::BasicBlock *, unsigned> size; // instructions in B's dominator subtree
+	for (llvm::DomTreeNode *N : llvm::post_order(DT.getRootNode())) {
+	  llvm::BasicBlock *B = N->getBlock();
+	  bool& c = cold[B] = !hot.contains(B);
+	  unsigned& n = size[B] = B->size();
+	  for (llvm::DomTreeNode *C : N->children()) {
+	    c &= cold[C->getBlock()];
+	    n += size[C->getBlock()];
+	  }
 	}
-	
-	// 1. Inline callees in this function.
 
-	// Inline functions due to NCAS-CALL in caller.
-	for (llvm::CallGraphNode *CGN : SCC) {
-	  llvm::Function *F = CGN->getFunction();
-	  if (F == nullptr)
+	std::vector<std::vector<llvm::BasicBlock *>> regions;
+	for (llvm::DomTreeNode *N : llvm::depth_first(DT.getRootNode())) {
+	  llvm::BasicBlock *B = N->getBlock();
+	  const llvm::DomTreeNode *IDom = N->getIDom();
+	  if (!cold[B] || IDom == nullptr || (IDom->getIDom() != nullptr && cold[IDom->getBlock()]))
 	    continue;
-	  
-	  bool changed;
-	  do {
-	    changed = false;
-
-	    std::set<llvm::Instruction *> seen;
-	    std::set<llvm::CallBase *> calls;
-	    std::stack<llvm::Instruction *> todo;
-	    for (llvm::StoreInst *SI : compute_nca_stores(*F))
-	      todo.push(SI);
-	    
-	    while (!todo.empty()) {
-	      llvm::Instruction *I = todo.top();
-	      todo.pop();
-
-	      if (!seen.insert(I).second)
-		continue;
-
-	      // If we see a direct call, then note it and stop exploring path.
-	      if (auto *C = llvm::dyn_cast<llvm::CallBase>(I)) {
-		if (util::mayLowerToFunctionCall(*C)) {
-		  calls.insert(C);
-		  continue;
-		}
-	      }
-
-	      // If we see a NCA load that may leak, then stop exploring path.
-	      auto& ST = getAnalysis<SpeculativeTaint>(*F);
-	      auto& LA = getAnalysis<LeakAnalysis>(*F);						       
-	      if (ST.secret(I) && LA.mayLeak(I))
-		continue;
-
-	      // TODO: Also check for other stuff?
-
-	      // Otherwise, continue exploring successors.
-	      for (llvm::Instruction *Succ : llvm::successors_inst(I))
-		todo.push(Succ);
-	    }
-
-	    // Try to inline the marked calls.
-	    for (llvm::CallBase *Call : calls) {
-	      if (!inlinable.contains(util::getCalledFunction(Call)))
-		continue;
-	      llvm::InlineFunctionInfo IFI;
-	      const auto result = llvm::InlineFunction(*Call, IFI);
-	      if (!result.isSuccess())
-		continue;
-	      changed = true;
-	    }
-
-	    // Now inline callees that have requested it.
-	    for (llvm::CallBase& C : util::instructions<llvm::CallBase>(*F)) {
-	      if (callees_to_inline.contains(util::getCalledFunction(&C))) {
-		llvm::InlineFunctionInfo IFI;
-		const auto result = llvm::InlineFunction(C, IFI);
-		if (!result.isSuccess())
-		  continue;
-		changed = true;
-	      }
-	    }
-
-	  } while (changed && false);
+	  if (size[B] < MinOutlineSize)
+	    continue;
+	  std::vector<llvm::BasicBlock *> region;
+	  for (llvm::DomTreeNode *M : llvm::depth_first(N))
+	    region.push_back(M->getBlock());
+	  regions.push_back(std::move(region));
 	}
 
-	// 2. Calculate whether this function would benefit from inlining into caller.
-	if (SCC.size() == 1) {
-	  llvm::Function& F = *(**SCC.begin()).getFunction();
-	  bool ncas_ret = false;
-	  std::stack<llvm::Instruction *> todo;
-	  std::set<llvm::Instruction *> seen;
-	  for (llvm::StoreInst *SI : compute_nca_stores(F))
-	    todo.push(SI);
-	  while (!todo.empty()) {
-	    auto *I = todo.top();
-	    todo.pop();
-	    if (!seen.insert(I).second)
-	      continue;
-
-	    if (llvm::isa<llvm::ReturnInst>(I)) {
-	      ncas_ret = true;
-	      break;
-	    }
-	    
-	    if (auto *C = llvm::dyn_cast<llvm::CallBase>(I))
-	      if (util::mayLowerToFunctionCall(*C))
-		continue;
-
-	    auto& ST = getAnalysis<SpeculativeTaint>(F);
-	    auto& LA = getAnalysis<LeakAnalysis>(F);
-	    if (ST.secret(I) && LA.mayLeak(I))
-	      continue;
-
-	    for (auto *Succ : llvm::successors_inst(I))
-	      todo.push(Succ);
+	bool changed = false;
+	llvm::CodeExtractorAnalysisCache CEAC(F);
+	for (const auto& region : regions) {
+	  llvm::CodeExtractor CE(region, &DT, /*AggregateArgs*/false, nullptr, nullptr, nullptr, /*AllowVarArgs*/false,
+				 /*AllowAlloca*/false, "llsct.cold");
+	  if (!CE.isEligible())
+	    continue;
+	  if (llvm::Function *Outlined = CE.extractCodeRegion(CEAC)) {
+	    // Keep the split: the point is for callers to inline only the hazard region.
+	    Outlined->addFnAttr(llvm::Attribute::NoInline);
+	    changed = true;
 	  }
-
-	  if (ncas_ret)
-	    callees_to_inline.insert(&F);
 	}
+	return changed;
+      }
 
-	// 3. Add inlinable functions.
-	{
-	  const auto defined_funcs = llvm::count_if(SCC, [] (auto *CGN) {
-	    return CGN->getFunction() != nullptr;
-	  });
-	  if (defined_funcs == 1)
-	    for (auto *CGN : SCC)
-	      if (auto *F = CGN->getFunction())
-		inlinable.insert(F);
+      bool runOnModule(llvm::Module& M) override {
+	summaries.clear();
+	unsigned module_size = 0;
+	for (const llvm::Function& F : M)
+	  module_size += F.getInstructionCount();
+	module_budget = MaxModuleGrowth * module_size;
+
+	// Snapshot the SCCs in post-order (callees first), since inlining mutates the call graph.
+	auto& CG = getAnalysis<llvm::CallGraphWrapperPass>().getCallGraph();
+	std::vector<std::set<llvm::Function *>> sccs;
+	for (auto it = llvm::scc_begin(&CG); !it.isAtEnd(); ++it) {
+	  std::set<llvm::Function *> scc;
+	  for (llvm::CallGraphNode *CGN : *it)
+	    if (llvm::Function *F = CGN->getFunction(); F && !F->isDeclaration())
+	      scc.insert(F);
+	  if (!scc.empty())
+	    sccs.push_back(std::move(scc));
 	}
 
-	return true;
+	bool changed = false;
+	for (const auto& scc : sccs)
+	  for (llvm::Function *F : scc)
+	    changed |= runOnFunction(*F, scc);
+
+	// The summary flags are only meaningful within this pass.
+	for (llvm::Function& F : M) {
+	  for (llvm::CallBase& C : util::instructions<llvm::CallBase>(F)) {
+	    C.setMetadata(md::nca_call, nullptr);
+	    C.setMetadata(md::entry_call, nullptr);
+	  }
+	}
+	return changed;
       }
     };
-
-#endif
     
 
     llvm::RegisterPass<InlinePass> X {"clou-inline-hints", "LLVM-SCT's Inlining Pass"};
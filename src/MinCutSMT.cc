@@ -1,6 +1,250 @@
-#include "MinCutSMT.h"
+#include "clou/MinCutSMT.h"
+
+#include <stack>
+#include <numeric>
+#include <chrono>
+
+#include <llvm/ADT/BitVector.h>
+#include <llvm/ADT/STLExtras.h>
+#include <llvm/ADT/ScopeExit.h>
+#include <llvm/Support/CommandLine.h>
+#include <llvm/Support/WithColor.h>
+#include <llvm/Support/raw_ostream.h>
+
+#ifdef HAVE_Z3
+# include <z3++.h>
+#endif
 
 namespace clou {
-  
-  
+
+  unsigned exact_min_cut_threshold;
+  static llvm::cl::opt<unsigned, true> exact_min_cut_threshold_flag {
+    "clou-min-cut-exact-threshold",
+    llvm::cl::desc("Refine greedy min-cut with exact Z3 solver for graphs with at most this many nodes (0 = disable)"),
+    llvm::cl::location(exact_min_cut_threshold),
+    llvm::cl::init(256),
+  };
+
+  static llvm::cl::opt<unsigned> exact_min_cut_timeout {
+    "clou-min-cut-exact-timeout",
+    llvm::cl::desc("Timeout in milliseconds for each run of the exact min-cut solver"),
+    llvm::cl::init(200),
+  };
+
+  static llvm::cl::opt<unsigned> exact_min_cut_budget {
+    "clou-min-cut-exact-budget",
+    llvm::cl::desc("Total time in milliseconds the exact min-cut solver may spend per module (0 = unlimited)"),
+    llvm::cl::init(2000),
+  };
+
+  // Solver time left in the current module's budget, in milliseconds.
+  static unsigned exact_min_cut_budget_left;
+
+  void reset_min_cut_smt_budget() {
+    exact_min_cut_budget_left = exact_min_cut_budget;
+  }
+
+  namespace {
+
+    using IdxGraph = std::vector<std::map<unsigned, unsigned>>;
+
+    llvm::BitVector reach_fwd(const IdxGraph& G, const llvm::BitVector& S) {
+      llvm::BitVector reach(G.size(), false);
+      std::stack<unsigned> todo;
+      for (unsigned u : S.set_bits())
+	todo.push(u);
+      while (!todo.empty()) {
+	const unsigned u = todo.top();
+	todo.pop();
+	for (const auto& [v, w] : G[u]) {
+	  if (reach.test(v))
+	    continue;
+	  reach.set(v);
+	  todo.push(v);
+	}
+      }
+      return reach;
+    }
+
+    llvm::BitVector reach_bwd(const std::vector<std::vector<unsigned>>& Grev, const llvm::BitVector& T) {
+      llvm::BitVector reach = T;
+      std::stack<unsigned> todo;
+      for (unsigned v : T.set_bits())
+	todo.push(v);
+      while (!todo.empty()) {
+	const unsigned v = todo.top();
+	todo.pop();
+	for (unsigned u : Grev[v]) {
+	  if (reach.test(u))
+	    continue;
+	  reach.set(u);
+	  todo.push(u);
+	}
+      }
+      return reach;
+    }
+
+    llvm::BitVector to_bitvector(const std::set<unsigned>& S, unsigned n) {
+      llvm::BitVector bv(n, false);
+      for (unsigned u : S)
+	bv.set(u);
+      return bv;
+    }
+
+  }
+
+  std::optional<std::vector<std::pair<unsigned, unsigned>>>
+  min_cut_smt(const IdxGraph& G, llvm::ArrayRef<std::vector<std::set<unsigned>>> sts,
+	      llvm::ArrayRef<std::pair<unsigned, unsigned>> upper_bound) {
+#ifdef HAVE_Z3
+    using Edge = std::pair<unsigned, unsigned>;
+    const unsigned n = G.size();
+
+    std::vector<std::vector<unsigned>> Grev(n);
+    for (unsigned u = 0; u < n; ++u)
+      for (const auto& [v, w] : G[u])
+	Grev[v].push_back(u);
+
+    const std::set<Edge> ub_set(upper_bound.begin(), upper_bound.end());
+    const int ub_weight = std::accumulate(ub_set.begin(), ub_set.end(), 0, [&G] (int acc, const Edge& e) {
+      return acc + static_cast<int>(G[e.first].at(e.second));
+    });
+    if (ub_weight == 0)
+      return std::nullopt;
+
+    unsigned timeout = exact_min_cut_timeout;
+    if (exact_min_cut_budget > 0) {
+      if (exact_min_cut_budget_left == 0)
+	return std::nullopt;
+      timeout = std::min(timeout, exact_min_cut_budget_left);
+    }
+
+    // Charge the whole run, including building the problem, against the module's budget.
+    const auto start = std::chrono::steady_clock::now();
+    const auto charge = llvm::make_scope_exit([start] {
+      if (exact_min_cut_budget == 0)
+	return;
+      const auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+      exact_min_cut_budget_left -= std::min<unsigned>(exact_min_cut_budget_left, elapsed.count());
+    });
+
+    try {
+      z3::context ctx;
+      z3::optimize solver(ctx);
+      {
+	z3::params p(ctx);
+	p.set("timeout", timeout);
+	solver.set(p);
+      }
+
+      // Edge cut variables, created on demand so that only edges relevant to some ST appear in the problem.
+      std::map<Edge, z3::expr> cut_vars;
+      const auto cut_var = [&] (unsigned u, unsigned v) -> const z3::expr& {
+	auto it = cut_vars.find({u, v});
+	if (it == cut_vars.end()) {
+	  const std::string name = "cut-" + std::to_string(u) + "-" + std::to_string(v);
+	  it = cut_vars.emplace(Edge(u, v), ctx.bool_const(name.c_str())).first;
+	}
+	return it->second;
+      };
+
+      for (unsigned st_idx = 0; const auto& st : sts) {
+	assert(st.size() >= 2);
+	const unsigned layers = st.size() - 1;
+
+	// Restrict each layer to nodes that can be reached from the previous waypoint and can reach the next one.
+	std::vector<llvm::BitVector> relevant;
+	{
+	  llvm::BitVector S = to_bitvector(st.front(), n);
+	  for (unsigned i = 0; i < layers; ++i) {
+	    const llvm::BitVector T = to_bitvector(st[i + 1], n);
+	    llvm::BitVector rel = reach_fwd(G, S);
+	    rel &= reach_bwd(Grev, T);
+	    relevant.push_back(rel);
+	    S = T;
+	    S &= rel;
+	  }
+	}
+
+	// reach[i][u]: u may be reached in layer i.
+	const auto reach_var = [&] (unsigned i, unsigned u) {
+	  const std::string name = "reach-" + std::to_string(st_idx) + "-" + std::to_string(i) + "-" + std::to_string(u);
+	  return ctx.bool_const(name.c_str());
+	};
+
+	for (unsigned i = 0; i < layers; ++i) {
+	  const llvm::BitVector& rel = relevant[i];
+
+	  // Seed layer i from the waypoints W_i.
+	  for (unsigned u : st[i]) {
+	    if (i > 0 && !relevant[i - 1].test(u))
+	      continue;
+	    for (const auto& [v, w] : G[u]) {
+	      if (!rel.test(v))
+		continue;
+	      z3::expr reached = !cut_var(u, v);
+	      if (i > 0)
+		reached = reached && reach_var(i - 1, u);
+	      solver.add(z3::implies(reached, reach_var(i, v)));
+	    }
+	  }
+
+	  // Propagate reachability within layer i.
+	  for (unsigned u : rel.set_bits())
+	    for (const auto& [v, w] : G[u])
+	      if (rel.test(v))
+		solver.add(z3::implies(reach_var(i, u) && !cut_var(u, v), reach_var(i, v)));
+	}
+
+	// The final waypoints must be unreachable.
+	for (unsigned t : st.back())
+	  if (relevant.back().test(t))
+	    solver.add(!reach_var(layers - 1, t));
+
+	++st_idx;
+      }
+
+      if (cut_vars.empty())
+	return std::nullopt;
+
+      // Warm start: only accept solutions strictly cheaper than the greedy cut.
+      z3::expr_vector cut_exprs(ctx);
+      std::vector<int> weights;
+      for (const auto& [e, var] : cut_vars) {
+	const int w = G[e.first].at(e.second);
+	cut_exprs.push_back(var);
+	weights.push_back(w);
+	solver.add_soft(!var, w);
+      }
+      solver.add(z3::pble(cut_exprs, weights.data(), ub_weight - 1));
+
+      switch (solver.check()) {
+      case z3::sat:
+	break;
+      case z3::unsat:
+	// The greedy cut is optimal.
+	return std::nullopt;
+      case z3::unknown:
+	llvm::WithColor::warning() << "exact min-cut solver gave up; keeping greedy cut\n";
+	return std::nullopt;
+      }
+
+      const z3::model model = solver.get_model();
+      std::vector<Edge> cut;
+      for (const auto& [e, var] : cut_vars)
+	if (model.eval(var, true).is_true())
+	  cut.push_back(e);
+      return cut;
+    } catch (const z3::exception& e) {
+      llvm::WithColor::warning() << "exact min-cut solver failed: " << e.msg() << "\n";
+      return std::nullopt;
+    }
+#else
+    (void) G;
+    (void) sts;
+    (void) upper_bound;
+    return std::nullopt;
+#endif
+  }
+
 }
@@ -1,5 +1,6 @@
 
 #include <ctime>
+#include <cmath>
 
 #include <fstream>
 #include <map>
@@ -8,6 +9,7 @@
 #include <sstream>
 #include <vector>
 #include <variant>
+#include <optional>
 #include <iomanip>
 #include <csignal>
 #include <cstdlib>
@@ -126,6 +128,24 @@ namespace clou {
       llvm::cl::desc("Log execution times of Mitigate Pass"),
     };
 
+    llvm::cl::opt<float> SplitEdgeWeight {
+      "clou-split-edge-weight",
+      llvm::cl::desc("Relative cost of a fence on a critical edge (which requires a new block and jump) vs. an in-block fence"),
+      llvm::cl::init(1.5),
+    };
+
+    llvm::cl::opt<bool> SLHMasking {
+      "clou-slh",
+      llvm::cl::desc("Harden eligible NCA loads with SLH-style masking instead of LFENCEs when cheaper"),
+      llvm::cl::init(false),
+    };
+
+    llvm::cl::opt<float> SLHMaskCost {
+      "clou-slh-mask-cost",
+      llvm::cl::desc("Relative cost of one SLH masking instruction vs. an LFENCE"),
+      llvm::cl::init(0.05),
+    };
+
     static void handle_timeout(int sig) {
       (void) sig;
       assert(sig == SIGALRM);
@@ -311,11 +331,78 @@ namespace clou {
 	checkCutST(st.waypoints, cutset, F);
     }
 
+    /* For each cut edge, returns the categories of the STs with an s-t path through it in the uncut graph G, i.e., the
+     * categories of STs that forced it to be cut. categories[i] is the category of sts[i]. */
+    static std::map<Edge, std::set<std::string>> getCutEdgeCategories(const Alg::Graph& G, llvm::ArrayRef<ST> sts,
+								     llvm::ArrayRef<const char *> categories,
+								     llvm::ArrayRef<Edge> cut_edges) {
+      std::map<Node, std::vector<Node>> preds;
+      for (const auto& [u, usuccs] : G)
+	for (const auto& [v, weight] : usuccs)
+	  preds[v].push_back(u);
+
+      // Returns S together with the nodes reachable from S (forward) or that can reach S (backward).
+      const auto reach = [&] (const std::set<Node>& S, bool forward) {
+	std::set<Node> seen = S;
+	std::stack<Node> todo;
+	for (const Node& u : S)
+	  todo.push(u);
+	while (!todo.empty()) {
+	  const Node u = todo.top();
+	  todo.pop();
+	  const auto visit = [&] (const Node& v) {
+	    if (seen.insert(v).second)
+	      todo.push(v);
+	  };
+	  if (forward) {
+	    if (const auto it = G.find(u); it != G.end())
+	      for (const auto& [v, weight] : it->second)
+		visit(v);
+	  } else {
+	    if (const auto it = preds.find(u); it != preds.end())
+	      for (const Node& v : it->second)
+		visit(v);
+	  }
+	}
+	return seen;
+      };
+
+      std::map<Edge, std::set<std::string>> edge_categories;
+      for (const auto& [st, category] : llvm::zip(sts, categories)) {
+	// Restrict each waypoint to the nodes on some path through all the waypoints.
+	std::vector<std::set<Node>> S = {st.waypoints.front()};
+	for (const std::set<Node>& T : llvm::ArrayRef(st.waypoints).drop_front()) {
+	  const std::set<Node> fwd = reach(S.back(), true);
+	  std::set_intersection(T.begin(), T.end(), fwd.begin(), fwd.end(), std::inserter(S.emplace_back(), S.back().end()));
+	}
+	if (S.back().empty())
+	  continue;
+	for (size_t i = S.size() - 1; i > 0; --i) {
+	  const std::set<Node> bwd = reach(S[i], false);
+	  std::erase_if(S[i - 1], [&bwd] (const Node& u) { return !bwd.contains(u); });
+	}
+
+	for (size_t i = 0; i + 1 < S.size(); ++i) {
+	  const std::set<Node> fwd = reach(S[i], true);
+	  const std::set<Node> bwd = reach(S[i + 1], false);
+	  for (const Edge& e : cut_edges)
+	    if (fwd.contains(e.src) && bwd.contains(e.dst))
+	      edge_categories[e].insert(category);
+	}
+      }
+      return edge_categories;
+    }
+
     struct MitigatePass final : public llvm::FunctionPass {
       static inline char ID = 0;
     
       MitigatePass() : llvm::FunctionPass(ID) {}
 
+      bool doInitialization(llvm::Module&) override {
+	reset_min_cut_smt_budget();
+	return false;
+      }
+
       void getAnalysisUsage(llvm::AnalysisUsage &AU) const override {
 	AU.addRequired<ConstantAddressAnalysis>();
 	AU.addRequired<NonspeculativeTaint>();
@@ -324,8 +411,10 @@ namespace clou {
       }
 
       static unsigned compute_edge_weight([[maybe_unused]] llvm::Instruction *src, llvm::Instruction *dst, [[maybe_unused]] const llvm::DominatorTree& DT, const llvm::LoopInfo& LI) {
+	// Fences on critical edges also pay for the new block and the extra jump introduced by llvm::SplitEdge.
+	const float split_factor = isCriticalEdge(src, dst) ? SplitEdgeWeight : 1.;
 	if (WeightGraph) {
-	  float score = 1.;
+	  float score = split_factor;
 #if 1
 	  const unsigned LoopDepth = std::min(instruction_loop_nest_depth(src, LI), instruction_loop_nest_depth(dst, LI));
 # if 0
@@ -341,10 +430,18 @@ namespace clou {
 	  score *= 1. / pow(DomDepth + 1, DominatorWeight);
 	  return score * 1000;
 	} else {
-	  return 1;
+	  return std::max<long>(1, std::lround(split_factor));
 	}
       }
 
+      // Relative cost of executing a single instruction at I, on the same scale as compute_edge_weight.
+      static float compute_site_weight(llvm::Instruction *I, const llvm::LoopInfo& LI) {
+	if (WeightGraph)
+	  return pow(instruction_loop_nest_depth(I, LI) + 1, LoopWeight) * 1000;
+	else
+	  return 1;
+      }
+
       template <class OutputIt>
       OutputIt getPublicLoads(llvm::Function& F, ConstantAddressAnalysis& CAA, OutputIt out) {
 	LeakAnalysis& LA = getAnalysis<LeakAnalysis>();
@@ -660,6 +757,12 @@ namespace clou {
 	/* Stats */
 	llvm::json::Object log;
 
+	// The category of each ST in A, i.e., the enabled.* option that added it (for the log).
+	std::vector<const char *> st_categories;
+	const auto tag_sts = [&] (const char *category) {
+	  st_categories.resize(A.get_sts().size(), category);
+	};
+
 	CountStat stat_ncas_xmit(log, "sts_ncas_xmit");
 	CountStat stat_ncas_ctrl(log, "sts_ncas_ctrl");
 	CountStat stat_ncal_xmit(log, "sts_ncal_xmit");
@@ -858,6 +961,7 @@ namespace clou {
 	    ++stat_ncas_xmit;
 	  }
 
+	  tag_sts("ncas_xmit");
 	}
 
 
@@ -886,8 +990,23 @@ namespace clou {
 	    A.add_st(make_node_set(ncas),
 		     make_node_set(ctrls));
 	  }
+	  tag_sts("ncas_ctrl");
 	}
 
+	// NCA loads whose only speculation sources are conditional branches in this function can alternatively be
+	// protected by SLH-style masking (see HardenLoads), which covers all of their {ncal X transmitter} STs.
+	std::set<llvm::LoadInst *> slh_loads;
+	std::set<Alg::ST> slh_sts;
+	const auto can_mask = [&] (llvm::Instruction *ncal) {
+	  auto *LI = llvm::dyn_cast<llvm::LoadInst>(ncal);
+	  if (!SLHMasking || LI == nullptr || !canHardenLoad(LI) || ncal == &F.front().front())
+	    return false;
+	  return llvm::all_of(get_sources(ncal), [] (llvm::Instruction *I) {
+	    auto *BI = llvm::dyn_cast<llvm::BranchInst>(I);
+	    return BI && BI->isConditional();
+	  });
+	};
+
 	if (enabled.ncal_xmit) {
 
 	  // Create ST-pairs for {source X transmitter}
@@ -904,9 +1023,14 @@ namespace clou {
 		A.add_st(make_node_set(sources), std::set<Node>{ncal}, std::set<Node>{xmit});
 		++stat_ncal_xmit;
 	      }
+	      if (can_mask(ncal)) {
+		slh_loads.insert(llvm::cast<llvm::LoadInst>(ncal));
+		slh_sts.insert(A.get_sts().back());
+	      }
 	    }
 	  }
 	  
+	  tag_sts("ncal_xmit");
 	}
 
 	if (enabled.ncal_glob) {
@@ -921,6 +1045,7 @@ namespace clou {
 	    }
 	  }
 	  
+	  tag_sts("ncal_glob");
 	}
 
 	if (enabled.entry_xmit) {
@@ -969,6 +1094,7 @@ namespace clou {
 	  }
 
 	  A.add_st(std::set<Node>{&F.front().front()}, xmits);
+	  tag_sts("entry_xmit");
 	}
 
 	if (enabled.load_xmit) {
@@ -1045,6 +1171,7 @@ namespace clou {
 	    A.add_st(make_node_set(entries), make_node_set(stacks));
 	  }
 	    
+	  tag_sts("load_xmit");
 	}
 
 	// LLSCT-SSBD
@@ -1059,6 +1186,7 @@ namespace clou {
 	    if (util::mayLowerToFunctionCall(call))
 	      calls.insert(&call);
 	  A.add_st(make_node_set(calls), make_node_set(xmits));	  
+	  tag_sts("call_xmit");
 	}
 
 	// Add CFG to graph
@@ -1108,9 +1236,46 @@ namespace clou {
 	cull_sts(sts);
 #endif
 	auto G_ = G;
-	const auto sts_bak = A.get_sts().vec();
+	auto sts_bak = A.get_sts().vec();
+	std::optional<Alg> A_slh;
+	if (!slh_sts.empty()) {
+	  A_slh.emplace(A);
+	  A_slh->erase_sts_if([&] (const Alg::ST& st) { return slh_sts.contains(st); });
+	}
 	std::cerr << "Min-Cut on " << F.getName().str() << std::endl;
 	A.run();
+
+	// Compare fencing everything against masking the eligible loads and fencing the rest.
+	CountStat stat_slh_loads(log, "slh_loads");
+	if (A_slh) {
+	  A_slh->run();
+	  const auto cut_cost = [&G_] (const std::vector<Edge>& cut) {
+	    float cost = 0;
+	    for (const Edge& e : cut)
+	      cost += G_.at(e.src).at(e.dst);
+	    return cost;
+	  };
+	  float mask_cost = 0;
+	  for (llvm::BranchInst& BI : util::instructions<llvm::BranchInst>(F))
+	    if (BI.isConditional())
+	      mask_cost += 2 * compute_site_weight(&BI, LI);
+	  for (llvm::LoadInst *SLH_LI : slh_loads)
+	    mask_cost += compute_site_weight(SLH_LI, LI);
+	  mask_cost *= SLHMaskCost;
+	  if (cut_cost(A_slh->cut_edges) + mask_cost < cut_cost(A.cut_edges)) {
+	    A.cut_edges = std::move(A_slh->cut_edges);
+	    std::vector<const char *> slh_categories;
+	    for (const auto& [st, category] : llvm::zip(sts_bak, st_categories))
+	      if (!slh_sts.contains(st))
+		slh_categories.push_back(category);
+	    st_categories = std::move(slh_categories);
+	    sts_bak = A_slh->get_sts().vec();
+	    stat_slh_loads += slh_loads.size();
+	  } else {
+	    slh_loads.clear();
+	  }
+	}
+
 	const clock_t solve_stop = clock();
 	const float solve_duration = (static_cast<float>(solve_stop) - static_cast<float>(solve_start)) / CLOCKS_PER_SEC;
 	auto& cut_edges = A.cut_edges;
@@ -1276,8 +1441,25 @@ namespace clou {
 
 	// Mitigations
 	auto& lfence_srclocs = log["lfence_srclocs"] = llvm::json::Array();
+	std::map<Edge, std::set<std::string>> edge_categories;
+	if (ClouLog)
+	  edge_categories = getCutEdgeCategories(G_, sts_bak, st_categories, cut_edges);
+	CountStat stat_split_edges(log, "split_edges");
+	CountStat stat_split_critical_edges(log, "split_critical_edges");
+	// Per-function site IDs, in cut order, so that fences with the same description (e.g., without debug locations)
+	// can still be told apart in the logs and traces (see TracePass).
+	uint64_t site_id = 0;
 	for (const auto& [src, dst] : cut_edges) {
-	  if (llvm::Instruction *mitigation_point = getMitigationPoint(llvm::cast<llvm::Instruction>(src.V), llvm::cast<llvm::Instruction>(dst.V))) {
+	  auto *src_I = llvm::cast<llvm::Instruction>(src.V);
+	  auto *dst_I = llvm::cast<llvm::Instruction>(dst.V);
+	  const bool critical = isCriticalEdge(src_I, dst_I);
+	  bool split;
+	  if (llvm::Instruction *mitigation_point = getMitigationPoint(src_I, dst_I, split)) {
+	    if (split) {
+	      ++stat_split_edges;
+	      if (critical)
+		++stat_split_critical_edges;
+	    }
 	    std::string s;
 	    llvm::raw_string_ostream os(s);
 	    const auto print_debug_loc = [&os] (const llvm::Value *V, bool forward) {
@@ -1292,21 +1474,30 @@ namespace clou {
 	      }
 	      DL.print(os);
 	    };
+	    os << F.getName() << ": ";
 	    print_debug_loc(src.V, false);
 	    os << "--->";
 	    print_debug_loc(dst.V, true);
-	    CreateMitigation(mitigation_point, s.c_str());
+	    CreateMitigation(mitigation_point, s.c_str())->setIdentifier(site_id);
 	    
 	    // Print out mitigation info
 	    if (ClouLog) {
 	      lfence_srclocs.getAsArray()->push_back(llvm::json::Object({
+		    {.K = "id", .V = site_id},
 		    {.K = "src", .V = str_debugloc(src.V)},
 		    {.K = "dst", .V = str_debugloc(dst.V)},
+		    {.K = "desc", .V = s},
+		    {.K = "weight", .V = G_.at(src).at(dst)},
+		    {.K = "categories", .V = llvm::json::Array(edge_categories[Edge {.src = src, .dst = dst}])},
 		  }));
 	    }
+	    ++site_id;
 	  }
 	}
 
+	// Masking must come after fence insertion, since it inserts PHIs at the front of blocks.
+	HardenLoads(F, std::vector<llvm::LoadInst *>(slh_loads.begin(), slh_loads.end()));
+
 	if (ClouLog) {
 	  std::ofstream f = openFile(F, ".ll");
 	  llvm::raw_os_ostream os(f);
@@ -1334,6 +1525,9 @@ namespace clou {
 	staticStats(log, F);
 	saveLog(std::move(log), F);
 
+	// The mitigations (e.g., SLH masking) rewrite pointer operands in place.
+	CAA.clearCache();
+
         return true;
       }
 
@@ -1343,7 +1537,13 @@ namespace clou {
 	return llvm::predecessors(dst).size() > 1;
       }
 
-      static llvm::Instruction *getMitigationPoint(llvm::Instruction *src, llvm::Instruction *dst) {
+      // Splitting this edge requires a new basic block reached by an extra jump.
+      static bool isCriticalEdge(llvm::Instruction *src, llvm::Instruction *dst) {
+	return src->isTerminator() && src->getNumSuccessors() > 1 && shouldCutEdge(src, dst);
+      }
+
+      static llvm::Instruction *getMitigationPoint(llvm::Instruction *src, llvm::Instruction *dst, bool& split) {
+	split = false;
 	if (shouldCutEdge(src, dst)) {
 	  assert(src->isTerminator());
 	  for (const llvm::Instruction *I = dst->getPrevNode(); I != nullptr; I = I->getPrevNode())
@@ -1351,6 +1551,7 @@ namespace clou {
 	  if (dst != &dst->getParent()->front())
 	    return nullptr;
 	  llvm::BasicBlock *B = llvm::SplitEdge(src->getParent(), dst->getParent());
+	  split = true;
 	  return &B->front();
 	} else {
 	  return dst;
@@ -1,22 +1,21 @@
 #include "clou/Mitigation.h"
 
 #include <cassert>
+#include <map>
 
 #include <llvm/IR/IntrinsicsX86.h>
 #include <llvm/IR/Instructions.h>
 #include <llvm/Clou/Clou.h>
+#include <llvm/IR/InlineAsm.h>
+#include <llvm/IR/CFG.h>
 
 #include "clou/Metadata.h"
 
 namespace clou {
 
   bool MitigationInst::classof(const llvm::IntrinsicInst *I) {
-#if 0
+    // Untagged lfences (e.g. a source-level _mm_lfence()) are not ours.
     return I->getIntrinsicID() == llvm::Intrinsic::x86_sse2_lfence && md::getMetadataFlag(I, mitigation_flag);
-#else
-    return I->getIntrinsicID() == llvm::Intrinsic::x86_sse2_lfence;
-    // FIXME: find out why commented out code doesn't work.
-#endif
   }
 
   bool MitigationInst::classof(const llvm::Value *V) {
@@ -27,14 +26,13 @@ namespace clou {
     }
   }
 
-#if 0
   void MitigationInst::setIdentifier(uint64_t id) {
     auto *CI = llvm::ConstantInt::get(llvm::Type::getInt64Ty(getContext()), id);
     auto *CAM = llvm::ConstantAsMetadata::get(CI);
-    getMetadata(mitigation_flag)->getOperand(0)->
-    llvm::cast<llvm::MDTuple>(getMetadata(mitigation_flag))->setOperand(0, CAM);
+    // Metadata tuples are uniqued, so build a new one rather than mutating the shared node.
+    llvm::MDNode *MDN = llvm::MDNode::get(getContext(), {CAM, getMetadata(mitigation_flag)->getOperand(1)});
+    setMetadata(mitigation_flag, MDN);
   }
-#endif
 
   llvm::ConstantInt *MitigationInst::getIdentifier() const {
     return llvm::cast<llvm::ConstantInt>(llvm::cast<llvm::ConstantAsMetadata>(getMetadata(mitigation_flag)->getOperand(0))->getValue());
@@ -67,5 +65,87 @@ namespace clou {
     return CreateMitigation(IRB, lfencestr);
   }
 
+  bool canHardenLoad(const llvm::LoadInst *LI) {
+    llvm::Type *T = LI->getType();
+    if (T->isPointerTy())
+      return true;
+    return T->isIntegerTy() && T->getIntegerBitWidth() <= 64;
+  }
+
+  void HardenLoads(llvm::Function& F, llvm::ArrayRef<llvm::LoadInst *> loads) {
+    if (loads.empty())
+      return;
+
+    llvm::LLVMContext& ctx = F.getContext();
+    llvm::IntegerType *StateTy = llvm::Type::getInt64Ty(ctx);
+    llvm::Constant *Zero = llvm::ConstantInt::get(StateTy, 0);
+    llvm::Constant *One = llvm::ConstantInt::get(StateTy, 1);
+
+    // The predicate updates are computed without branches, as state | mask, where the mask is derived arithmetically
+    // from the branch condition and then passed through an empty inline asm. The asm hides the mask's dependence on
+    // the condition, so the compiler can neither fold it using the (predicted) branch direction nor turn the update
+    // back into a select, which the backend might lower to a branch. It is marked as having side effects so that it
+    // stays in the branching block and is not sunk into the successors, where the condition is known.
+    llvm::InlineAsm *Opaque = llvm::InlineAsm::get(llvm::FunctionType::get(StateTy, {StateTy}, false),
+						   "# slh.mask $0", "=r,0", true);
+
+    // Predicate state at the top of each block.
+    std::map<llvm::BasicBlock *, llvm::Value *> state_in;
+    for (llvm::BasicBlock& B : F) {
+      if (&B == &F.getEntryBlock() || llvm::pred_empty(&B)) {
+	state_in[&B] = Zero;
+      } else {
+	state_in[&B] = llvm::PHINode::Create(StateTy, llvm::pred_size(&B), "slh.state", &B.front());
+      }
+    }
+
+    // Update the predicate state along each outgoing edge.
+    for (llvm::BasicBlock& B : F) {
+      llvm::Instruction *T = B.getTerminator();
+      llvm::Value *state = state_in.at(&B);
+      llvm::SmallVector<llvm::Value *, 2> state_out(T->getNumSuccessors(), state);
+
+      auto *BI = llvm::dyn_cast<llvm::BranchInst>(T);
+      if (BI && BI->isConditional() && BI->getSuccessor(0) != BI->getSuccessor(1)) {
+	llvm::IRBuilder<> IRB(BI);
+	llvm::Value *Cond = IRB.CreateZExt(BI->getCondition(), StateTy);
+	llvm::Value *TrueMask = IRB.CreateCall(Opaque, {IRB.CreateSub(Cond, One)}); // all-ones iff the condition is false
+	llvm::Value *FalseMask = IRB.CreateCall(Opaque, {IRB.CreateNeg(Cond)}); // all-ones iff the condition is true
+	state_out[0] = IRB.CreateOr(state, TrueMask, "slh.state.true");
+	state_out[1] = IRB.CreateOr(state, FalseMask, "slh.state.false");
+      }
+
+      for (unsigned i = 0; i < T->getNumSuccessors(); ++i)
+	if (auto *PHI = llvm::dyn_cast<llvm::PHINode>(state_in.at(T->getSuccessor(i))))
+	  PHI->addIncoming(state_out[i], &B);
+    }
+
+    // Mask the loaded values.
+    const llvm::DataLayout& DL = F.getParent()->getDataLayout();
+    for (llvm::LoadInst *LI : loads) {
+      assert(canHardenLoad(LI));
+      llvm::Value *state = state_in.at(LI->getParent());
+      if (state == Zero)
+	continue; // no conditional branch precedes this load
+      llvm::IRBuilder<> IRB(LI->getNextNode());
+      IRB.SetCurrentDebugLocation(LI->getDebugLoc());
+      llvm::Type *T = LI->getType();
+      llvm::Type *IntTy = T->isPointerTy() ? DL.getIntPtrType(T) : T;
+      llvm::Value *V = LI;
+      if (T->isPointerTy())
+	V = IRB.CreatePtrToInt(V, IntTy);
+      llvm::Value *mask = IRB.CreateZExtOrTrunc(state, IntTy);
+      auto *Masked = llvm::cast<llvm::Instruction>(IRB.CreateOr(V, mask, "slh.masked"));
+      md::setMetadataFlag(Masked, md::slh_mask);
+      // The only remaining use of the raw loaded value.
+      llvm::User *User = (V == LI) ? Masked : llvm::cast<llvm::User>(V);
+      llvm::Value *Result = Masked;
+      if (T->isPointerTy())
+	Result = IRB.CreateIntToPtr(Masked, T);
+      LI->replaceUsesWithIf(Result, [User] (llvm::Use& U) {
+	return U.getUser() != User;
+      });
+    }
+  }
 
 }
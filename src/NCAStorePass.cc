@@ -54,6 +54,7 @@ namespace clou {
 	    switch (II->getIntrinsicID()) {
 	    case llvm::Intrinsic::fshr:
 	    case llvm::Intrinsic::fshl:
+	    case llvm::Intrinsic::x86_sse2_lfence:
 	    case llvm::Intrinsic::x86_aesni_aesenc:
 	    case llvm::Intrinsic::x86_aesni_aeskeygenassist:
 	    case llvm::Intrinsic::x86_aesni_aesenclast:
@@ -3,43 +3,68 @@
 #include <llvm/IR/IRBuilder.h>
 #include <llvm/IR/InstIterator.h>
 #include <llvm/IR/Instructions.h>
+#include <llvm/Support/CommandLine.h>
 
 #include "clou/util.h"
+#include "clou/Zeroing.h"
+#include "clou/analysis/StackInitAnalysis.h"
 
 namespace clou {
   namespace {
 
+    llvm::cl::opt<bool> VolatileInit {
+      "llsct-stack-init-volatile",
+      llvm::cl::desc("Emit stack initialization as volatile stores, so that no later pass can remove or merge them"),
+      llvm::cl::init(false),
+    };
+
     struct StackInitPass final : public llvm::FunctionPass {
       static inline char ID = 0;
       StackInitPass(): llvm::FunctionPass(ID) {}
 
-      bool runOnFunction(llvm::Function& F) override {
-	const auto orig_icount = F.getInstructionCount();
-	llvm::DataLayout DL(F.getParent());
-	for (llvm::Instruction& I : llvm::instructions(F)) {
-	  if (auto *AI = llvm::dyn_cast<llvm::AllocaInst>(&I)) {
-	    llvm::IRBuilder IRB(AI->getNextNode());
-	    llvm::Constant *EltSize = IRB.getInt64(DL.getTypeAllocSize(AI->getAllocatedType()));
-	    if (AI->isArrayAllocation()) {
-	      llvm::Constant *Zero = IRB.getInt8(0);
-	      llvm::Value *Size = IRB.CreateMul(EltSize, AI->getArraySize());
-	      llvm::Value *Ptr = IRB.CreateBitCast(AI, IRB.getInt8PtrTy());
-	      IRB.CreateMemSet(Ptr, Zero, Size, llvm::MaybeAlign(), /*isVolatile*/true);
-	    } else if (AI->getAllocatedType()->isIntOrPtrTy()) {
-	      llvm::Constant *Zero = llvm::Constant::getNullValue(AI->getAllocatedType());
-	      IRB.CreateStore(Zero, AI, /*isVolatile*/true);
-	    } else {
-	      // Memset struct or array or something
-	      llvm::Constant *Zero = IRB.getInt8(0);
-	      llvm::Value *Ptr = IRB.CreateBitCast(AI, IRB.getInt8PtrTy());
-	      IRB.CreateMemSet(Ptr, Zero, EltSize, llvm::MaybeAlign(), /*isVolatile*/true);
-	    }
+      void getAnalysisUsage(llvm::AnalysisUsage& AU) const override {
+	AU.addRequired<StackInitAnalysis>();
+      }
+
+      /* StackInitAnalysis only reports bytes that some leaky load may read before they are written on some path, so
+       * the initializing store is not dead and non-volatile stores are safe from DSE; they remain free to be merged
+       * with neighbouring stores.
+       */
+      static void initialize(llvm::AllocaInst *AI, const StackInitAnalysis::Result& result, llvm::Instruction *InsertPt) {
+	const llvm::DataLayout& DL = AI->getModule()->getDataLayout();
+	llvm::IRBuilder IRB(InsertPt);
+	llvm::Value *Ptr = IRB.CreateBitCast(AI, IRB.getInt8PtrTy());
+	if (!result.range) {
+	  llvm::Value *Size = IRB.getInt64(DL.getTypeAllocSize(AI->getAllocatedType()));
+	  if (AI->isArrayAllocation())
+	    Size = IRB.CreateMul(Size, IRB.CreateZExtOrTrunc(AI->getArraySize(), IRB.getInt64Ty()));
+	  CreateZero(IRB, Ptr, Size, AI->getAlign(), VolatileInit);
+	  return;
+	}
+
+	const auto [begin, end] = *result.range;
+	if (begin == 0 && end == DL.getTypeStoreSize(AI->getAllocatedType()) && AI->getAllocatedType()->isIntOrPtrTy() &&
+	    !AI->isArrayAllocation()) {
+	  IRB.CreateAlignedStore(llvm::Constant::getNullValue(AI->getAllocatedType()), AI, AI->getAlign(), VolatileInit);
+	} else {
+	  Ptr = IRB.CreateConstInBoundsGEP1_64(IRB.getInt8Ty(), Ptr, begin);
+	  CreateZero(IRB, Ptr, end - begin, llvm::commonAlignment(AI->getAlign(), begin), VolatileInit);
+	}
+      }
+
+      bool runOnFunction(llvm::Function&) override {
+	const auto& SIA = getAnalysis<StackInitAnalysis>();
+	bool changed = false;
+	for (const auto& [AI, result] : SIA.results) {
+	  for (llvm::Instruction *InsertPt : result.frontier) {
+	    initialize(AI, result, InsertPt);
+	    changed = true;
 	  }
 	}
-	return F.getInstructionCount() != orig_icount;
+	return changed;
       }
     };
-    
+
     const llvm::RegisterPass<StackInitPass> X {"llsct-stack-init-pass", "LLSCT's Stack Initialization Pass"};
     const util::RegisterClangPass<StackInitPass> Y;
   }
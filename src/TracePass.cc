@@ -1,4 +1,5 @@
 #include <string>
+#include <vector>
 
 #include <llvm/Pass.h>
 #include <llvm/IR/IRBuilder.h>
@@ -6,6 +7,7 @@
 #include <llvm/IR/Instruction.h>
 #include <llvm/IR/InstIterator.h>
 #include <llvm/Support/raw_ostream.h>
+#include <llvm/Transforms/Utils/ModuleUtils.h>
 
 #include "clou/util.h"
 #include "clou/Mitigation.h"
@@ -13,34 +15,69 @@
 namespace clou {
   namespace {
 
-    struct TracePass final : public llvm::FunctionPass {
+    /* Counts executions of each mitigation. Each mitigation in the module gets a slot in a per-module counter array,
+     * which is bumped with a relaxed atomic add, so tracing is safe in multi-threaded programs and costs no call or
+     * lookup per fence. A module constructor registers the counters and site descriptions with the runtime
+     * (tools/trace_runtime.cc):
+     *   void clou_trace_register(uint64_t *counters, const char *const *descs, uint64_t n);
+     * The identifier in the clou.mitigation metadata (MitigatePass's per-function site ID) is left alone and appended to
+     * the description as " #<id>", which matches the "desc" and "id" of the site in the -clou-log logs.
+     */
+    struct TracePass final : public llvm::ModulePass {
       static inline char ID = 0;
-      TracePass(): llvm::FunctionPass(ID) {}
+      TracePass(): llvm::ModulePass(ID) {}
 
-      static llvm::FunctionCallee getTraceFunc(llvm::IRBuilder<>& IRB) {
-	llvm::Module *M = IRB.GetInsertBlock()->getModule();
-	llvm::FunctionType *fty = llvm::FunctionType::get(IRB.getVoidTy(), {IRB.getInt8PtrTy()}, false);
-	return M->getOrInsertFunction("clou_trace", fty);
-      }
+      bool runOnModule(llvm::Module& M) override {
+	std::vector<MitigationInst *> sites;
+	for (llvm::Function& F : M)
+	  for (MitigationInst& MI : util::instructions<MitigationInst>(F))
+	    sites.push_back(&MI);
+	if (sites.empty())
+	  return false;
+
+	llvm::LLVMContext& ctx = M.getContext();
+	llvm::IntegerType *I64 = llvm::Type::getInt64Ty(ctx);
+	llvm::PointerType *I8Ptr = llvm::Type::getInt8PtrTy(ctx);
+	const uint64_t n = sites.size();
+
+	auto *counters_ty = llvm::ArrayType::get(I64, n);
+	auto *counters = new llvm::GlobalVariable(M, counters_ty, false, llvm::GlobalVariable::PrivateLinkage,
+						  llvm::Constant::getNullValue(counters_ty), "clou.trace.counters");
+	// Give each counter array its own cache lines, so it does not falsely share with program data.
+	counters->setAlignment(llvm::Align(64));
+
+	std::vector<llvm::Constant *> descs;
+	for (uint64_t id = 0; id < n; ++id) {
+	  MitigationInst *MI = sites[id];
+	  std::string desc_str = MI->getDescription().str();
+	  if (const int64_t site_id = MI->getIdentifier()->getSExtValue(); site_id >= 0)
+	    desc_str += " #" + std::to_string(site_id);
+	  llvm::Constant *desc = llvm::ConstantDataArray::getString(ctx, desc_str, true);
+	  auto *desc_var = new llvm::GlobalVariable(M, desc->getType(), true, llvm::GlobalVariable::PrivateLinkage, desc);
+	  descs.push_back(llvm::ConstantExpr::getBitCast(desc_var, I8Ptr));
 
-      bool runOnFunction(llvm::Function& F) override {
-	llvm::Module& M = *F.getParent();
-	for (llvm::Instruction& I : llvm::instructions(F)) {
-	  if (auto *MI = llvm::dyn_cast<MitigationInst>(&I)) {
-	    llvm::IRBuilder<> IRB(MI);
-	    const llvm::DebugLoc& DL = MI->getDebugLoc();
-	    IRB.SetCurrentDebugLocation(DL);
-
-	    const auto s = MI->getDescription();
-
-	    auto *byte_array = llvm::ConstantDataArray::getString(IRB.getContext(), s, true);
-	    auto *byte_var = new llvm::GlobalVariable(M, byte_array->getType(), true, llvm::GlobalVariable::PrivateLinkage,
-						      byte_array);
-	    auto *byte_ptr = IRB.CreateBitCast(byte_var, IRB.getInt8PtrTy());
-	    llvm::Instruction *CI = IRB.CreateCall(getTraceFunc(IRB), {byte_ptr});
-	    CI->copyMetadata(*MI);
-	  }
+	  llvm::IRBuilder<> IRB(MI);
+	  IRB.SetCurrentDebugLocation(MI->getDebugLoc());
+	  llvm::Value *counter = IRB.CreateConstInBoundsGEP2_64(counters_ty, counters, 0, id);
+	  IRB.CreateAtomicRMW(llvm::AtomicRMWInst::Add, counter, IRB.getInt64(1), llvm::MaybeAlign(8),
+			      llvm::AtomicOrdering::Monotonic);
 	}
+
+	auto *descs_ty = llvm::ArrayType::get(I8Ptr, n);
+	auto *descs_var = new llvm::GlobalVariable(M, descs_ty, true, llvm::GlobalVariable::PrivateLinkage,
+						   llvm::ConstantArray::get(descs_ty, descs), "clou.trace.descs");
+
+	llvm::FunctionType *register_ty = llvm::FunctionType::get(llvm::Type::getVoidTy(ctx), {I64->getPointerTo(), I8Ptr->getPointerTo(), I64}, false);
+	llvm::FunctionCallee register_fn = M.getOrInsertFunction("clou_trace_register", register_ty);
+	auto *ctor = llvm::Function::Create(llvm::FunctionType::get(llvm::Type::getVoidTy(ctx), false),
+					    llvm::Function::InternalLinkage, "clou.trace.ctor", M);
+	llvm::IRBuilder<> IRB(llvm::BasicBlock::Create(ctx, "", ctor));
+	IRB.CreateCall(register_fn, {IRB.CreateConstInBoundsGEP2_64(counters_ty, counters, 0, 0),
+				     IRB.CreateConstInBoundsGEP2_64(descs_ty, descs_var, 0, 0),
+				     IRB.getInt64(n)});
+	IRB.CreateRetVoid();
+	llvm::appendToGlobalCtors(M, ctor, 0);
+
 	return true;
       }
     };
@@ -48,8 +85,8 @@ namespace clou {
     llvm::RegisterPass<TracePass> X {"trace-pass", "Trace Pass"};
     util::RegisterClangPass<TracePass> Y {
       llvm::PassManagerBuilder::EP_OptimizerLast,
-      llvm::PassManagerBuilder::EP_EnabledOnOptLevel0,      
+      llvm::PassManagerBuilder::EP_EnabledOnOptLevel0,
     };
-    
+
   }
 }
@@ -2,6 +2,7 @@
 
 #include <llvm/IR/Intrinsics.h>
 #include <llvm/IR/IntrinsicInst.h>
+#include <llvm/IR/IntrinsicsX86.h>
 #include <llvm/Support/raw_ostream.h>
 
 #include "clou/Mitigation.h"
@@ -16,6 +17,7 @@ namespace clou {
 	switch (II->getIntrinsicID()) {
 	case llvm::Intrinsic::fshr:
 	case llvm::Intrinsic::fshl:
+	case llvm::Intrinsic::x86_sse2_lfence:
 	  return true;
 	default:
 	  warn_unhandled_intrinsic(II);
@@ -0,0 +1,142 @@
+#include "clou/Zeroing.h"
+
+#include <algorithm>
+#include <cassert>
+
+#include <llvm/IR/InlineAsm.h>
+#include <llvm/IR/IntrinsicsX86.h>
+#include <llvm/Support/CommandLine.h>
+#include <llvm/Transforms/Utils/BasicBlockUtils.h>
+
+namespace clou {
+
+  namespace {
+
+    llvm::cl::opt<bool> UseMemSet {
+      "clou-zero-memset",
+      llvm::cl::desc("Zero memory with the generic memset intrinsic instead of size-specialized sequences"),
+      llvm::cl::init(false),
+    };
+
+    llvm::cl::opt<unsigned> InlineMax {
+      "clou-zero-inline-max",
+      llvm::cl::desc("Maximum size (in bytes) zeroed with straight-line vector stores"),
+      llvm::cl::init(256),
+    };
+
+    llvm::cl::opt<unsigned> NonTemporalMin {
+      "clou-zero-nontemporal-min",
+      llvm::cl::desc("Minimum size (in bytes) zeroed with non-temporal stores (0 = never); only pays off for buffers larger than the LLC"),
+      llvm::cl::init(0),
+    };
+
+    /* Widest vector store (in bytes) the function may use. */
+    unsigned getVectorWidth(const llvm::Function& F) {
+      const llvm::StringRef features = F.getFnAttribute("target-features").getValueAsString();
+      unsigned width = 16;
+      if (features.contains("+avx512f"))
+	width = 64;
+      else if (features.contains("+avx"))
+	width = 32;
+      // Respect -mprefer-vector-width, which is how clang avoids 512-bit frequency penalties.
+      unsigned prefer;
+      if (!F.getFnAttribute("prefer-vector-width").getValueAsString().getAsInteger(10, prefer))
+	width = std::min(width, std::max(prefer / 8, 16U));
+      return width;
+    }
+
+    llvm::StoreInst *CreateZeroStore(llvm::IRBuilder<>& IRB, llvm::Value *Ptr8, uint64_t Offset, unsigned Bytes,
+				     llvm::Align Alignment, bool isVolatile) {
+      llvm::Type *Ty;
+      if (Bytes <= 8)
+	Ty = IRB.getIntNTy(Bytes * 8);
+      else
+	Ty = llvm::FixedVectorType::get(IRB.getInt8Ty(), Bytes);
+      llvm::Value *Ptr = IRB.CreateConstInBoundsGEP1_64(IRB.getInt8Ty(), Ptr8, Offset);
+      Ptr = IRB.CreateBitCast(Ptr, Ty->getPointerTo());
+      return IRB.CreateAlignedStore(llvm::Constant::getNullValue(Ty), Ptr, llvm::commonAlignment(Alignment, Offset), isVolatile);
+    }
+
+    /* Zeroes [Begin, End) with stores no wider than Width, widest first. */
+    void CreateZeroStores(llvm::IRBuilder<>& IRB, llvm::Value *Ptr8, uint64_t Begin, uint64_t End, unsigned Width,
+			  llvm::Align Alignment, bool isVolatile) {
+      uint64_t Offset = Begin;
+      for (unsigned Bytes = Width; Bytes > 0; Bytes /= 2) {
+	for (; Offset + Bytes <= End; Offset += Bytes) {
+	  CreateZeroStore(IRB, Ptr8, Offset, Bytes, Alignment, isVolatile);
+	}
+      }
+    }
+
+    void CreateRepStosb(llvm::IRBuilder<>& IRB, llvm::Value *Ptr8, llvm::Value *Size) {
+      llvm::Type *I8Ptr = IRB.getInt8PtrTy();
+      llvm::Type *I64 = IRB.getInt64Ty();
+      auto *T = llvm::FunctionType::get(llvm::StructType::get(I8Ptr, I64), {I8Ptr, I64, IRB.getInt8Ty()}, false);
+      // rep stosb always has side effects from the compiler's point of view, so it is never removed or merged.
+      auto *Asm = llvm::InlineAsm::get(T, "rep stosb", "={di},={cx},0,1,{al},~{memory},~{dirflag},~{fpsr},~{flags}",
+				       /*hasSideEffects*/true);
+      IRB.CreateCall(Asm, {Ptr8, IRB.CreateZExtOrTrunc(Size, I64), IRB.getInt8(0)});
+    }
+
+    /* Emits a loop of non-temporal Width-byte stores covering [0, Size - Size % Width) followed by an sfence. The loop
+     * runs at least once, so Size must be at least Width.
+     */
+    void CreateNonTemporalLoop(llvm::IRBuilder<>& IRB, llvm::Value *Ptr8, uint64_t Size, unsigned Width, bool isVolatile) {
+      assert(Size >= Width);
+      llvm::LLVMContext& ctx = IRB.getContext();
+      llvm::Instruction *InsertPt = &*IRB.GetInsertPoint();
+      llvm::BasicBlock *Head = InsertPt->getParent();
+      llvm::BasicBlock *Tail = llvm::SplitBlock(Head, InsertPt);
+      llvm::BasicBlock *Loop = llvm::BasicBlock::Create(ctx, "clou.zero.loop", Head->getParent(), Tail);
+      Head->getTerminator()->setSuccessor(0, Loop);
+
+      llvm::IRBuilder<> LoopIRB(Loop);
+      llvm::PHINode *Idx = LoopIRB.CreatePHI(LoopIRB.getInt64Ty(), 2);
+      Idx->addIncoming(LoopIRB.getInt64(0), Head);
+      llvm::Type *VecTy = llvm::FixedVectorType::get(LoopIRB.getInt8Ty(), Width);
+      llvm::Value *Ptr = LoopIRB.CreateInBoundsGEP(LoopIRB.getInt8Ty(), Ptr8, Idx);
+      Ptr = LoopIRB.CreateBitCast(Ptr, VecTy->getPointerTo());
+      llvm::StoreInst *SI = LoopIRB.CreateAlignedStore(llvm::Constant::getNullValue(VecTy), Ptr, llvm::Align(Width), isVolatile);
+      SI->setMetadata(llvm::LLVMContext::MD_nontemporal,
+		      llvm::MDNode::get(ctx, llvm::ConstantAsMetadata::get(LoopIRB.getInt32(1))));
+      llvm::Value *Next = LoopIRB.CreateNUWAdd(Idx, LoopIRB.getInt64(Width));
+      Idx->addIncoming(Next, Loop);
+      LoopIRB.CreateCondBr(LoopIRB.CreateICmpULT(Next, LoopIRB.getInt64(Size - Size % Width)), Loop, Tail);
+
+      IRB.SetInsertPoint(InsertPt);
+      IRB.CreateIntrinsic(llvm::Intrinsic::x86_sse_sfence, {}, {});
+    }
+
+  }
+
+  void CreateZero(llvm::IRBuilder<>& IRB, llvm::Value *Ptr, uint64_t Size, llvm::Align Alignment, bool isVolatile) {
+    if (Size == 0)
+      return;
+    if (UseMemSet) {
+      IRB.CreateMemSet(Ptr, IRB.getInt8(0), IRB.getInt64(Size), Alignment, isVolatile);
+      return;
+    }
+
+    const unsigned Width = getVectorWidth(*IRB.GetInsertBlock()->getParent());
+    llvm::Value *Ptr8 = IRB.CreateBitCast(Ptr, IRB.getInt8PtrTy());
+    if (Size <= InlineMax) {
+      CreateZeroStores(IRB, Ptr8, 0, Size, Width, Alignment, isVolatile);
+    } else if (NonTemporalMin != 0 && Size >= NonTemporalMin && Size >= Width && Alignment.value() >= Width) {
+      CreateNonTemporalLoop(IRB, Ptr8, Size, Width, isVolatile);
+      CreateZeroStores(IRB, Ptr8, Size - Size % Width, Size, Width, Alignment, isVolatile);
+    } else {
+      CreateRepStosb(IRB, Ptr8, IRB.getInt64(Size));
+    }
+  }
+
+  void CreateZero(llvm::IRBuilder<>& IRB, llvm::Value *Ptr, llvm::Value *Size, llvm::MaybeAlign Alignment, bool isVolatile) {
+    if (auto *C = llvm::dyn_cast<llvm::ConstantInt>(Size)) {
+      CreateZero(IRB, Ptr, C->getZExtValue(), Alignment.valueOrOne(), isVolatile);
+    } else if (UseMemSet) {
+      IRB.CreateMemSet(Ptr, IRB.getInt8(0), Size, Alignment, isVolatile);
+    } else {
+      CreateRepStosb(IRB, IRB.CreateBitCast(Ptr, IRB.getInt8PtrTy()), Size);
+    }
+  }
+
+}
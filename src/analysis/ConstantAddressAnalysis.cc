@@ -1,5 +1,7 @@
 #include "clou/analysis/ConstantAddressAnalysis.h"
 
+#include <stack>
+
 #include "clou/util.h"
 
 namespace clou {
@@ -10,8 +12,8 @@ namespace clou {
 
   bool ConstantAddressAnalysis::runOnModule(llvm::Module& M) {
     ca_args.clear();
+    cache.clear();
     auto& map = ca_args;
-    std::map<const llvm::Function *, ArgumentSet> bak;
 
     // Get list of direct-call-only functions (these are the only ones we can make assumptions about).
     std::vector<const llvm::Function *> functions;
@@ -29,58 +31,71 @@ namespace clou {
 	  args.insert(&arg);
     }
 
-    // Run data-flow analysis until fixpoint.
-    do {
-      bak = map;
-
-      for (const llvm::Function *Callee : functions) {
-	ArgumentSet& args = map.at(Callee);
-	
-	// Iterate over callers of callee.
-	for (const llvm::User *User : Callee->users()) {
-	  const llvm::CallBase *I = llvm::cast<llvm::CallBase>(User);
-
-	  // Try to prove that each argument is non-constant-address.
-	  for (auto it = args.begin(); it != args.end(); ) {
-	    const llvm::Argument *A = *it;
-	    const unsigned ArgNo = A->getArgNo();
-	    const bool is_nca = ArgNo >= I->arg_size() || !isConstantAddress(I->getArgOperand(ArgNo));
-	    if (is_nca) {
-	      it = args.erase(it); 
+    // Summarize each call site once: a callee argument is constant-address only if, at every call site, the actual
+    // argument is structurally constant-address and the caller arguments it is derived from are constant-address.
+    // Arguments that fail the structural check are removed immediately; the rest record reverse dependencies.
+    std::map<const llvm::Argument *, std::vector<const llvm::Argument *>> dependents;
+    std::stack<const llvm::Argument *> todo;
+    const auto remove = [&] (const llvm::Argument *A) {
+      if (map.at(A->getParent()).erase(A))
+	todo.push(A);
+    };
+
+    for (const llvm::Function *Callee : functions) {
+      const ArgumentSet args = map.at(Callee);
+      for (const llvm::User *User : Callee->users()) {
+	const llvm::CallBase *I = llvm::cast<llvm::CallBase>(User);
+	for (const llvm::Argument *A : args) {
+	  const unsigned ArgNo = A->getArgNo();
+	  ArgumentSet deps;
+	  if (ArgNo >= I->arg_size() || !getArgumentDependencies(I->getArgOperand(ArgNo), deps)) {
+	    remove(A);
+	    continue;
+	  }
+	  for (const llvm::Argument *Dep : deps) {
+	    if (map.contains(Dep->getParent())) {
+	      dependents[Dep].push_back(A);
 	    } else {
-	      ++it;
+	      // Arguments of functions with unknown callers are never constant-address.
+	      remove(A);
 	    }
 	  }
-	  
 	}
       }
-      
-    } while (map != bak);
+    }
+
+    // Propagate removals along the dependencies until fixpoint. Each argument is removed at most once.
+    while (!todo.empty()) {
+      const llvm::Argument *Dep = todo.top();
+      todo.pop();
+      const auto it = dependents.find(Dep);
+      if (it == dependents.end())
+	continue;
+      for (const llvm::Argument *A : it->second)
+	remove(A);
+    }
 
     return false;
   }
 
-  bool ConstantAddressAnalysis::isConstantAddress(const llvm::Value *V) const {
+  bool ConstantAddressAnalysis::getArgumentDependencies(const llvm::Value *V, ArgumentSet& deps) const {
     assert(V->getType()->isPointerTy());
     if (const llvm::Argument *A = llvm::dyn_cast<llvm::Argument>(V)) {
-      const auto it = ca_args.find(A->getParent());
-      if (it == ca_args.end())
-	return false;
-      else
-	return it->second.contains(A);
+      deps.insert(A);
+      return true;
     } else if (llvm::isa<llvm::PHINode, llvm::CallBase, llvm::LoadInst, llvm::IntToPtrInst>(V)) {
       return false;
     } else if (llvm::isa<llvm::Constant, llvm::AllocaInst>(V)) {
       return true;
     } else if (const auto *GEP = llvm::dyn_cast<llvm::GetElementPtrInst>(V)) {
-      return GEP->hasAllConstantIndices() && isConstantAddress(GEP->getPointerOperand());
+      return GEP->hasAllConstantIndices() && getArgumentDependencies(GEP->getPointerOperand(), deps);
     } else if (const auto *BC = llvm::dyn_cast<llvm::BitCastInst>(V)) {
       if (BC->getSrcTy()->isPointerTy())
-	return isConstantAddress(BC->getOperand(0));
+	return getArgumentDependencies(BC->getOperand(0), deps);
       else
 	return false;
     } else if (const auto *Select = llvm::dyn_cast<llvm::SelectInst>(V)) {
-      return isConstantAddress(Select->getTrueValue()) && isConstantAddress(Select->getFalseValue());
+      return getArgumentDependencies(Select->getTrueValue(), deps) && getArgumentDependencies(Select->getFalseValue(), deps);
     } else if (const auto *Extract = llvm::dyn_cast<llvm::ExtractElementInst>(V)) {
       return llvm::isa<llvm::Constant>(Extract->getVectorOperand()) && llvm::isa<llvm::Constant>(Extract->getIndexOperand());
     } else if (const auto *Extract = llvm::dyn_cast<llvm::ExtractValueInst>(V)) {
@@ -90,6 +105,21 @@ namespace clou {
     }
   }
 
+  bool ConstantAddressAnalysis::isConstantAddress(const llvm::Value *V) const {
+    assert(V->getType()->isPointerTy());
+    const auto it = cache.find(V);
+    if (it != cache.end())
+      return it->second;
+
+    ArgumentSet deps;
+    const bool result = getArgumentDependencies(V, deps) && llvm::all_of(deps, [this] (const llvm::Argument *A) {
+      const auto it = ca_args.find(A->getParent());
+      return it != ca_args.end() && it->second.contains(A);
+    });
+    cache[V] = result;
+    return result;
+  }
+
   static llvm::RegisterPass<ConstantAddressAnalysis> X {"constant-address-analysis", "LLSCT's Constant Address Analysis", false, true};
 
 }
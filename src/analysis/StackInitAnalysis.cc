@@ -6,9 +6,11 @@
 #include <queue>
 
 #include <llvm/IR/Instructions.h>
+#include <llvm/IR/IntrinsicInst.h>
 #include <llvm/Analysis/AliasAnalysis.h>
 #include <llvm/Analysis/DependenceAnalysis.h>
 #include <llvm/IR/Dominators.h>
+#include <llvm/Analysis/LoopInfo.h>
 #include <llvm/IR/DataLayout.h>
 #include <llvm/Analysis/MemoryLocation.h>
 #include <llvm/ADT/STLExtras.h>
@@ -26,6 +28,7 @@ namespace clou {
 
   void StackInitAnalysis::getAnalysisUsage(llvm::AnalysisUsage& AU) const {
     AU.addRequired<llvm::AAResultsWrapperPass>();
+    AU.addRequired<llvm::DominatorTreeWrapperPass>();
     AU.addRequired<LeakAnalysis>();
     AU.addRequired<SpeculativeTaint>();
     AU.setPreservesAll();
@@ -36,22 +39,20 @@ namespace clou {
     results.clear();
     
     auto& AA = getAnalysis<llvm::AAResultsWrapperPass>().getAAResults();
+    auto& DT = getAnalysis<llvm::DominatorTreeWrapperPass>().getDomTree();
     auto& LA = getAnalysis<LeakAnalysis>();
     auto& ST = getAnalysis<SpeculativeTaint>();
 
-    llvm::DataLayout DL(F.getParent());
+    const llvm::DataLayout& DL = F.getParent()->getDataLayout();
 
-      // Iterate over all reads
+    // Iterate over all reads
     for (llvm::LoadInst& LI : util::instructions<llvm::LoadInst>(F)) {
       if (!LA.mayLeak(&LI) || ST.secret(&LI)) {
 	continue;
       }
 
-      llvm::errs() << "here\n";
-
-      
+      // If every path to the load passes through a must-alias store, the load never reads uninitialized memory.
       ISet must_alias_frontier;
-      // Try to find frontier set of must-alias stores
       const bool ok = forward_frontier(&LI, [&] (llvm::Instruction *I) {
 	if (auto *SI = llvm::dyn_cast<llvm::StoreInst>(I)) {
 	  if (AA.isMustAlias(&LI, SI)) {
@@ -60,57 +61,155 @@ namespace clou {
 	}
 	return false;
       }, must_alias_frontier);
+      if (ok)
+	continue;
 
-      if (ok) {
-	for (llvm::AllocaInst& AI : util::instructions<llvm::AllocaInst>(F)) {
-	  if (!AA.isNoAlias(&AI, LI.getPointerOperand())) {
-	    auto& result = results[&AI];
-	    result.loads.insert(&LI);
-	    llvm::copy(must_alias_frontier, std::inserter(result.stores, result.stores.end()));
-	  }
+      for (llvm::AllocaInst& AI : util::instructions<llvm::AllocaInst>(F)) {
+	if (!AA.isNoAlias(&AI, LI.getPointerOperand())) {
+	  results[&AI].loads.insert(&LI);
 	}
-      } else {
-	// Fallback: see if there's one 'may alias' write on the reverse frontier.
-	ISet may_alias_frontier;
-	const bool ok = reverse_frontier(&LI, [&] (llvm::Instruction *I) {
-	  const auto mri = AA.getModRefInfo(I, LI.getPointerOperand(),
-					    llvm::LocationSize::precise(DL.getTypeStoreSize(LI.getType())));
-	  return llvm::isModSet(mri);
-	}, may_alias_frontier);
-	assert(!may_alias_frontier.empty());
-	if (ok && may_alias_frontier.size() == 1) {
-	  for (llvm::AllocaInst& AI : util::instructions<llvm::AllocaInst>(F)) {
-	    if (!AA.isNoAlias(&AI, LI.getPointerOperand())) {
-	      auto& result = results[&AI];
-	      result.loads.insert(&LI);
-	      llvm::copy(may_alias_frontier, std::inserter(result.stores, result.stores.end()));
-	    }
-	  }
-	} else {
-	  // Just use front of current basic block. Might be able to improve on this in the future.
-	  // TODO: Optimize this.
-	  for (llvm::AllocaInst& AI : util::instructions<llvm::AllocaInst>(F)) {
-	    if (!AA.isNoAlias(&AI, LI.getPointerOperand())) {
-	      auto& result = results[&AI];
-	      result.loads.insert(&LI);
-	      llvm::copy(llvm::predecessors(&LI), std::inserter(result.stores, result.stores.end()));
-	    }
-	  }
+      }
+    }
+
+    // An alloca whose address escapes (passed to a call or memory intrinsic, stored to memory, ...) may be read by
+    // code we don't see, so it must be initialized in full.
+    std::set<llvm::AllocaInst *> escaped;
+    for (llvm::AllocaInst& AI : util::instructions<llvm::AllocaInst>(F)) {
+      if (escapes(&AI)) {
+	results[&AI];
+	escaped.insert(&AI);
+      }
+    }
+
+    for (auto& [AI, result] : results) {
+      result.frontier = computeFrontier(AI, DT);
+      if (escaped.contains(AI))
+	continue;
+
+      // Narrow the initialized range to the bytes the loads read, if they are all at constant offsets from the alloca.
+      const auto alloc_bits = AI->getAllocationSizeInBits(DL);
+      if (!AI->isStaticAlloca() || !alloc_bits)
+	continue;
+      const uint64_t alloc_size = alloc_bits->getFixedSize() / 8;
+      uint64_t begin = alloc_size, end = 0;
+      for (llvm::Instruction *I : result.loads) {
+	auto *LI = llvm::cast<llvm::LoadInst>(I);
+	llvm::APInt offset(DL.getIndexTypeSizeInBits(LI->getPointerOperandType()), 0);
+	const llvm::Value *Base = LI->getPointerOperand()->stripAndAccumulateConstantOffsets(DL, offset, /*AllowNonInbounds*/true);
+	if (Base != AI || offset.isNegative()) {
+	  begin = 0;
+	  end = alloc_size;
+	  break;
 	}
+	begin = std::min(begin, offset.getZExtValue());
+	end = std::max(end, offset.getZExtValue() + DL.getTypeStoreSize(LI->getType()).getFixedSize());
       }
+      end = std::min(end, alloc_size);
+      if (begin < end)
+	result.range = std::make_pair(begin, end);
+      else
+	result.frontier.clear();
     }
 
     return false;
   }
 
+  /* Returns whether any use of AI's address, through casts, GEPs, PHIs and selects, is something other than a load or a
+   * store to it, or a lifetime marker. */
+  bool StackInitAnalysis::escapes(llvm::AllocaInst *AI) {
+    std::set<llvm::Instruction *> seen = {AI};
+    std::vector<llvm::Instruction *> todo = {AI};
+    while (!todo.empty()) {
+      llvm::Instruction *I = todo.back();
+      todo.pop_back();
+      for (const llvm::Use& U : I->uses()) {
+	auto *UI = llvm::cast<llvm::Instruction>(U.getUser());
+	if (llvm::isa<llvm::LoadInst>(UI)) {
+	  continue;
+	} else if (auto *SI = llvm::dyn_cast<llvm::StoreInst>(UI)) {
+	  if (U.getOperandNo() != SI->getPointerOperandIndex())
+	    return true;
+	} else if (const auto *II = llvm::dyn_cast<llvm::IntrinsicInst>(UI); II && II->isLifetimeStartOrEnd()) {
+	  continue;
+	} else if (llvm::isa<llvm::BitCastInst, llvm::AddrSpaceCastInst, llvm::GetElementPtrInst, llvm::PHINode,
+		   llvm::SelectInst>(UI)) {
+	  if (seen.insert(UI).second)
+	    todo.push_back(UI);
+	} else {
+	  return true;
+	}
+      }
+    }
+    return false;
+  }
+
+  /* Initialization must happen after the allocation's storage becomes valid but before its first access.
+   * If the alloca has lifetime.start markers, each one begins a fresh (undefined) lifetime, so initialize right after
+   * each marker. Otherwise, initialize at the nearest common dominator of all accesses, before the first access there,
+   * hoisted out of any loops that don't contain the alloca itself: re-zeroing on every iteration would clobber values
+   * carried across iterations.
+   */
+  ISet StackInitAnalysis::computeFrontier(llvm::AllocaInst *AI, llvm::DominatorTree& DT) {
+    ISet frontier;
+    ISet accesses;
+    std::vector<llvm::Instruction *> todo = {AI};
+    while (!todo.empty()) {
+      llvm::Instruction *I = todo.back();
+      todo.pop_back();
+      for (llvm::User *U : I->users()) {
+	auto *UI = llvm::cast<llvm::Instruction>(U);
+	if (const auto *II = llvm::dyn_cast<llvm::IntrinsicInst>(UI); II && II->isLifetimeStartOrEnd()) {
+	  if (II->getIntrinsicID() == llvm::Intrinsic::lifetime_start)
+	    frontier.insert(UI->getNextNode());
+	} else if (llvm::isa<llvm::BitCastInst, llvm::AddrSpaceCastInst, llvm::GetElementPtrInst>(UI)) {
+	  todo.push_back(UI);
+	} else if (auto *PHI = llvm::dyn_cast<llvm::PHINode>(UI)) {
+	  for (unsigned i = 0; i < PHI->getNumIncomingValues(); ++i)
+	    if (PHI->getIncomingValue(i) == I)
+	      accesses.insert(PHI->getIncomingBlock(i)->getTerminator());
+	} else {
+	  accesses.insert(UI);
+	}
+      }
+    }
+
+    if (!frontier.empty() || accesses.empty())
+      return frontier;
+
+    llvm::BasicBlock *B = (*accesses.begin())->getParent();
+    for (llvm::Instruction *I : accesses)
+      B = DT.findNearestCommonDominator(B, I->getParent());
+    llvm::Instruction *InsertPt = B->getTerminator();
+    for (llvm::Instruction& I : *B) {
+      if (accesses.contains(&I)) {
+	InsertPt = &I;
+	break;
+      }
+    }
+
+    // The header of the outermost such loop has its immediate dominator outside of all loops, and it is dominated by
+    // the alloca, which is not in the loop.
+    llvm::LoopInfo Loops(DT);
+    llvm::Loop *Outermost = nullptr;
+    for (llvm::Loop *L = Loops.getLoopFor(B); L && !L->contains(AI); L = L->getParentLoop())
+      Outermost = L;
+    if (Outermost)
+      InsertPt = DT.getNode(Outermost->getHeader())->getIDom()->getBlock()->getTerminator();
+
+    frontier.insert(InsertPt);
+    return frontier;
+  }
+
 
   void StackInitAnalysis::print(llvm::raw_ostream& os, const llvm::Module *) const {
     for (const auto& [AI, result] : results) {
       os << "Allocation: " << *AI << "\n";
-      os << "Stores:\n";
-      for (auto *store : result.stores) {
-	os << "  " << *store << "\n";
+      os << "Frontier:\n";
+      for (auto *I : result.frontier) {
+	os << "  " << *I << "\n";
       }
+      if (result.range)
+	os << "Range: [" << result.range->first << ", " << result.range->second << ")\n";
       os << "Loads:\n";
       for (auto *load : result.loads) {
 	os << "  " << *load << "\n";
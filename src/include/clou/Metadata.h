@@ -7,6 +7,9 @@ namespace clou::md {
   
   inline const char speculative_inbounds[] = "specinbounds";
   inline const char nospill[] = "clou.nospill";
+  inline const char slh_mask[] = "clou.slh";
+  inline const char nca_call[] = "clou.nca_call"; // InlinePass: an NCA store of the function reaches the call
+  inline const char entry_call[] = "clou.entry_call"; // InlinePass: the function's entry reaches the call
 
   void setMetadataFlag(llvm::Instruction *I, llvm::StringRef flag);
   bool getMetadataFlag(const llvm::Instruction *I, llvm::StringRef flag);  
@@ -79,6 +79,11 @@ public:
     assert(st.waypoints.size() >= 2);
   }
 
+  template <class Pred>
+  void erase_sts_if(Pred pred) {
+    std::erase_if(sts, pred);
+  }
+
   virtual void run() = 0;
 
 private:
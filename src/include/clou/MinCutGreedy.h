@@ -2,6 +2,7 @@
 
 #include "MinCutBase.h"
 #include "clou/FordFulkerson.h"
+#include "clou/MinCutSMT.h"
 
 #include <queue>
 #include <stack>
@@ -9,6 +10,7 @@
 #include <map>
 #include <set>
 
+#include <llvm/ADT/BitVector.h>
 #include <llvm/ADT/SmallSet.h>
 #include <llvm/Clou/Clou.h>
 #include <llvm/ADT/STLExtras.h>
@@ -307,6 +309,8 @@ namespace clou {
     }
     
   public:
+    /* Number of passes over the s-t pairs that the last run() took to reach a fixpoint. */
+    unsigned iterations = 0;
 
     void run() override {
 #if 0
@@ -383,8 +387,11 @@ namespace clou {
       // constexpr unsigned limit = 10; // maximum number of iterations to perform before bailing
       // constexpr float timeout = 100000.; // 10 seconds
       clock_t clock_start = clock();
+      bool timed_out = false;
+      iterations = 0;
       do {
 	changed = false;
+	++iterations;
 
 	for (const auto& [st, cut] : llvm::zip(sts, cuts)) {
 	  
@@ -450,6 +457,7 @@ namespace clou {
 	    mode = Mode::Augment;
 	  } else if (clou::Timeout > 0 && static_cast<float>(clock() - clock_start) / CLOCKS_PER_SEC >= clou::Timeout) {
 	    mode = Mode::Augment;
+	    timed_out = true;
 	    llvm::WithColor::warning() << "timeout reached: falling back to sub-optimal fence insertion\n";
 	  }
 	}
@@ -470,6 +478,23 @@ namespace clou {
 	
       } while (changed);
 
+      // For small graphs, try to improve on the greedy solution with the exact solver, unless the greedy pass already
+      // used up its time.
+      if (!sts.empty() && !timed_out && nodes.size() <= exact_min_cut_threshold) {
+	std::vector<std::vector<std::set<Idx>>> waypoints;
+	for (const IdxST& st : sts)
+	  waypoints.push_back(st.waypoints);
+	std::vector<std::pair<Idx, Idx>> greedy_cut;
+	for (const auto& cut : cuts)
+	  for (const IdxEdge& e : cut)
+	    greedy_cut.emplace_back(e.src, e.dst);
+	if (const auto exact_cut = min_cut_smt(OrigG, waypoints, greedy_cut)) {
+	  cuts.assign(1, {});
+	  llvm::transform(*exact_cut, std::back_inserter(cuts.front()), [] (const auto& p) -> IdxEdge {
+	    return {.src = p.first, .dst = p.second};
+	  });
+	}
+      }
 
 #if CHECK_CUTS
       checkCut(cuts, sts, OrigG);
@@ -3,7 +3,9 @@
 #include <llvm/IR/IRBuilder.h>
 #include <llvm/IR/IntrinsicInst.h>
 #include <llvm/IR/Instruction.h>
+#include <llvm/IR/Instructions.h>
 #include <llvm/ADT/StringRef.h>
+#include <llvm/ADT/ArrayRef.h>
 #include <llvm/IR/Value.h>
 #include <llvm/IR/Constants.h>
 
@@ -21,5 +23,13 @@ namespace clou {
 
   MitigationInst *CreateMitigation(llvm::Instruction *I, const char *lfencestr);
   MitigationInst *CreateMitigation(llvm::IRBuilder<>& IRB, const char *lfencestr);  
+
+  /* Speculative-load-hardening-style alternative to LFENCEs.
+   * HardenLoads threads a misspeculation predicate through all conditional branches of F (0 on the
+   * architectural path, all-ones once any branch in F has been mispredicted) and ORs it into the
+   * value of each given load, so mispredicted paths never observe the loaded value.
+   */
+  bool canHardenLoad(const llvm::LoadInst *LI);
+  void HardenLoads(llvm::Function& F, llvm::ArrayRef<llvm::LoadInst *> loads);
   
 }
@@ -0,0 +1,21 @@
+#pragma once
+
+#include <cstdint>
+
+#include <llvm/IR/IRBuilder.h>
+
+namespace clou {
+
+  /* Emits code that zeroes `Size` bytes at `Ptr` at the builder's insertion point, specialized on the size and the
+   * enclosing function's target features:
+   *  - up to -clou-zero-inline-max bytes: straight-line stores of the widest vector type (AVX-512, AVX, or SSE);
+   *  - at least -clou-zero-nontemporal-min bytes, if set (and vector-aligned): a loop of non-temporal vector stores;
+   *  - otherwise: rep stosb.
+   * May split the insertion block. The builder's insertion point is left after the emitted code.
+   */
+  void CreateZero(llvm::IRBuilder<>& IRB, llvm::Value *Ptr, uint64_t Size, llvm::Align Alignment, bool isVolatile);
+
+  /* Dynamically sized variant: emits rep stosb. */
+  void CreateZero(llvm::IRBuilder<>& IRB, llvm::Value *Ptr, llvm::Value *Size, llvm::MaybeAlign Alignment, bool isVolatile);
+
+}
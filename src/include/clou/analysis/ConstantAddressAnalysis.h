@@ -1,10 +1,12 @@
 #pragma once
 
 #include <map>
+#include <set>
 
 #include <llvm/Pass.h>
 #include <llvm/IR/Function.h>
 #include <llvm/IR/Module.h>
+#include <llvm/IR/ValueMap.h>
 
 namespace clou {
 
@@ -15,6 +17,14 @@ namespace clou {
 
     bool isConstantAddress(const llvm::Value *V) const;
 
+    /* Drops the memoized results of isConstantAddress. Passes that rewrite operands in place and keep querying (or
+     * that run before other consumers in the same pass manager, which keeps this analysis alive) must call this after
+     * mutating the IR, since a cached answer may depend on a value's old operands.
+     */
+    void clearCache() const {
+      cache.clear();
+    }
+
     std::set<const llvm::Argument *> getConstAddrArgs(const llvm::Function *F) const {
       const auto it = ca_args.find(F);
       if (it == ca_args.end())
@@ -27,6 +37,18 @@ namespace clou {
     using ArgumentSet = std::set<const llvm::Argument *>;
     std::map<const llvm::Function *, ArgumentSet> ca_args;
 
+    // Memoized results of isConstantAddress. Entries are dropped when values are deleted, but not when they are RAUW'd
+    // (the entry stays on the old value) or their operands change; see clearCache.
+    struct CacheConfig : llvm::ValueMapConfig<const llvm::Value *> {
+      enum { FollowRAUW = false };
+    };
+    mutable llvm::ValueMap<const llvm::Value *, bool, CacheConfig> cache;
+
+    /* Summary of a pointer value: returns false if it is never constant-address; otherwise, adds to `deps` the
+     * arguments of its function that must all be constant-address for the value to be constant-address.
+     */
+    bool getArgumentDependencies(const llvm::Value *V, ArgumentSet& deps) const;
+
     void getAnalysisUsage(llvm::AnalysisUsage& AU) const override;
     bool runOnModule(llvm::Module& M) override;
   };
@@ -4,9 +4,11 @@
 #include <vector>
 #include <set>
 #include <map>
+#include <optional>
 
 #include <llvm/Pass.h>
 #include <llvm/IR/Instructions.h>
+#include <llvm/IR/Dominators.h>
 
 #include "clou/containers.h"
 
@@ -22,14 +24,17 @@ namespace clou {
     void print(llvm::raw_ostream& os, const llvm::Module *) const override;
 
     struct Result {
-      ISet stores;
-      ISet loads;
+      ISet loads; // leaky loads that may read the allocation before it is written (none if only escaped)
+      ISet frontier; // initialize the allocation immediately before each of these instructions
+      std::optional<std::pair<uint64_t, uint64_t>> range; // bytes [begin, end) that may be read uninitialized; std::nullopt means the whole allocation
     };
 
     using Results = std::map<llvm::AllocaInst *, Result>;
     Results results;
     
   private:
+    static bool escapes(llvm::AllocaInst *AI);
+    static ISet computeFrontier(llvm::AllocaInst *AI, llvm::DominatorTree& DT);
   };
   
 }
@@ -51,6 +51,11 @@ namespace clou {
     bool mayLowerToFunctionCall(const llvm::CallBase& C);
     bool doesNotRecurse(const llvm::Function& F);
 
+    /* Records in M that code transformed by a pass is not thread-safe, by defining the weak, default-visibility
+     * string `__llsct_thread_unsafe` holding the reason. Harnesses can test for it with a weak declaration.
+     */
+    void markThreadUnsafe(llvm::Module& M, llvm::StringRef reason);
+
     llvm::StringRef linkageTypeToString(llvm::GlobalValue::LinkageTypes linkageType);    
   }
 
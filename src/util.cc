@@ -16,6 +16,8 @@
 #include <llvm/IR/Intrinsics.h>
 #include <llvm/IR/IntrinsicInst.h>
 #include <llvm/IR/IntrinsicsX86.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Transforms/Utils/ModuleUtils.h>
 
 #include "clou/Metadata.h"
 
@@ -168,32 +170,48 @@ namespace util {
   }
 
   namespace {
-    bool doesNotRecurseRec(const llvm::Function& F, std::set<const llvm::Function *>& seen) {
-      if (!seen.insert(&F).second)
-	return false;
-      if (F.doesNotRecurse())
+    /* active holds the functions on the current call chain, which recursion would revisit; done holds the functions
+     * already found not to recurse, which may be reached again along other call chains.
+     */
+    bool doesNotRecurseRec(const llvm::Function& F, std::set<const llvm::Function *>& active,
+			   std::set<const llvm::Function *>& done) {
+      if (done.contains(&F) || F.doesNotRecurse())
 	return true;
-      if (F.isDeclaration())
+      if (F.isDeclaration() || !active.insert(&F).second)
 	return false;
-      return llvm::all_of(llvm::instructions(F), [&] (const llvm::Instruction& I) {
+      const bool result = llvm::all_of(llvm::instructions(F), [&] (const llvm::Instruction& I) {
 	if (const auto *C = llvm::dyn_cast<llvm::CallBase>(&I)) {
 	  if (llvm::isa<llvm::IntrinsicInst>(&I))
 	    return true;
 	  const auto *CalledF = getCalledFunction(C);
 	  if (CalledF == nullptr)
 	    return false;
-	  if (doesNotRecurseRec(*CalledF, seen))
+	  if (doesNotRecurseRec(*CalledF, active, done))
 	    return true;
 	  return false;
 	}
 	return true;
       });
+      active.erase(&F);
+      if (result)
+	done.insert(&F);
+      return result;
     }
   }
 
   bool doesNotRecurse(const llvm::Function& F) {
-    std::set<const llvm::Function *> seen;
-    return doesNotRecurseRec(F, seen);
+    std::set<const llvm::Function *> active, done;
+    return doesNotRecurseRec(F, active, done);
+  }
+
+  void markThreadUnsafe(llvm::Module& M, llvm::StringRef reason) {
+    static const char name[] = "__llsct_thread_unsafe";
+    if (M.getNamedGlobal(name))
+      return;
+    llvm::Constant *init = llvm::ConstantDataArray::getString(M.getContext(), reason, true);
+    auto *GV = new llvm::GlobalVariable(M, init->getType(), true, llvm::GlobalValue::WeakAnyLinkage, init, name);
+    GV->setVisibility(llvm::GlobalValue::DefaultVisibility);
+    llvm::appendToUsed(M, {GV});
   }
 
   namespace {
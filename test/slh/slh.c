@@ -0,0 +1,26 @@
+/* NCA loads whose only speculation sources are conditional branches, each feeding a transmitter (a table lookup), so
+ * that MitigatePass -clou-slh masks them instead of fencing.
+ */
+
+unsigned char table[256];
+
+int lookup(const unsigned *idx, unsigned n, unsigned i) {
+  if (i < n)
+    return table[idx[i]];
+  return 0;
+}
+
+unsigned sum(const unsigned *idx, unsigned n) {
+  unsigned s = 0;
+  for (unsigned i = 0; i < n; ++i)
+    s += table[idx[i]];
+  return s;
+}
+
+unsigned select_sum(const unsigned *idx, unsigned n, int odd) {
+  unsigned s = 0;
+  for (unsigned i = 0; i < n; ++i)
+    if ((idx[i] & 1) == odd)
+      s += table[idx[i] >> 1];
+  return s;
+}
@@ -0,0 +1,37 @@
+# Decodes binary dumps written by the clou_trace runtime (tools/trace_runtime.cc) into "<count> <description>" lines,
+# aggregated by description, in the same format the runtime prints at exit.
+
+import argparse
+import struct
+import sys
+from collections import defaultdict
+
+parser = argparse.ArgumentParser()
+parser.add_argument('dump')
+parser.add_argument('--sites', action = 'store_true', help = 'print one line per site instead of aggregating')
+args = parser.parse_args()
+
+with open(args.dump, 'rb') as f:
+    data = f.read()
+
+if data[:8] != b'CLOUTRC1':
+    sys.exit(f'{args.dump}: not a clou_trace dump')
+(nsites,) = struct.unpack_from('=Q', data, 8)
+offset = 16
+sites = []
+for _ in range(nsites):
+    count, desclen = struct.unpack_from('=QI', data, offset)
+    offset += 12
+    desc = data[offset:offset + desclen].decode()
+    offset += desclen
+    sites.append((count, desc))
+
+if args.sites:
+    for count, desc in sites:
+        print(count, desc)
+else:
+    counts = defaultdict(int)
+    for count, desc in sites:
+        counts[desc] += count
+    for desc in sorted(counts):
+        print(counts[desc], desc)
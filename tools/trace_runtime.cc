@@ -1,37 +1,231 @@
-#include <libunwind.h>
-#include <err.h>
+/* Runtime for TracePass (src/TracePass.cc).
+ *
+ * Each instrumented module registers a dense array of per-site execution counters, which instrumented code bumps with
+ * relaxed atomic adds. Counts are reported:
+ *  - at exit, as text lines "<count> <description>" on stderr (aggregated by description), unless CLOU_TRACE_FILE is
+ *    set, in which case they are written to that file in the binary format below;
+ *  - on SIGUSR1, and every CLOU_TRACE_INTERVAL seconds if set, to CLOU_TRACE_FILE in the binary format.
+ *
+ * Binary format (native endianness): the magic "CLOUTRC1", the number of sites as a u64, then for each site its count
+ * as a u64, the length of its description as a u32, and the description bytes. Dumps are written to a temporary file
+ * that is renamed over CLOU_TRACE_FILE, so readers never see a partial dump; one dump is written at a time (a periodic
+ * or SIGUSR1 dump is skipped if another is in progress). Use tools/trace-decode.py to decode.
+ *
+ * Counters can also be read in-process (e.g. by bench/fences-main.cc) with clou_trace_num_sites, clou_trace_read and
+ * clou_trace_site_desc below, which number sites across modules in registration order.
+ */
+
+#include <atomic>
+#include <cerrno>
+#include <csignal>
+#include <cstdint>
+#include <cstdio>
 #include <cstdlib>
 #include <cstring>
-#include <string>
 #include <map>
-#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <chrono>
 
-#define UNW_CHK(name, res)					\
-  do {								\
-    const int err_ = (res);					\
-    if (err_ < 0) {						\
-      errx(EXIT_FAILURE, name ": %s", unw_strerror(-err_));	\
-    }								\
-  } while (false)
+#include <fcntl.h>
+#include <unistd.h>
 
 namespace {
 
-  static FILE *log = stderr;
+  struct Module {
+    std::atomic<uint64_t> *counters;
+    const char *const *descs;
+    uint64_t n;
+  };
+
+  // Modules are registered from constructors and never unregistered. The registry is a fixed array so that the signal
+  // handler can walk it without locking.
+  constexpr unsigned max_modules = 4096;
+  Module modules[max_modules];
+  std::atomic<unsigned> num_modules = 0;
+  std::mutex register_mutex;
+
+  const char *trace_file = nullptr;
+  bool quiet = false;
+  char trace_tmp_file[4096];
+  // Held while writing trace_tmp_file. A lock-free atomic_flag, so the signal handler can try it.
+  std::atomic_flag dumping = ATOMIC_FLAG_INIT;
+
+  /* Async-signal-safe buffered writer. */
+  struct Writer {
+    int fd;
+    char buf[4096];
+    size_t len = 0;
+    bool ok = true;
+
+    explicit Writer(int fd): fd(fd) {}
+
+    void flush() {
+      for (size_t off = 0; ok && off < len; ) {
+	const ssize_t res = ::write(fd, buf + off, len - off);
+	if (res < 0 && errno != EINTR)
+	  ok = false;
+	else if (res > 0)
+	  off += res;
+      }
+      len = 0;
+    }
+
+    void write(const void *data, size_t size) {
+      const char *p = static_cast<const char *>(data);
+      while (size > 0) {
+	if (len == sizeof buf)
+	  flush();
+	const size_t n = std::min(size, sizeof buf - len);
+	std::memcpy(buf + len, p, n);
+	len += n;
+	p += n;
+	size -= n;
+      }
+    }
+  };
+
+  /* Writes all counters to CLOU_TRACE_FILE in the binary format. If another dump is in progress, waits for it if `wait`
+   * and otherwise skips this one. Only uses async-signal-safe functions when not waiting.
+   */
+  void dump_binary(bool wait) {
+    while (dumping.test_and_set(std::memory_order_acquire)) {
+      if (!wait)
+	return;
+      std::this_thread::yield();
+    }
+
+    const int saved_errno = errno;
+    const int fd = ::open(trace_tmp_file, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+      errno = saved_errno;
+      dumping.clear(std::memory_order_release);
+      return;
+    }
+
+    const unsigned m = num_modules.load(std::memory_order_acquire);
+    uint64_t nsites = 0;
+    for (unsigned i = 0; i < m; ++i)
+      nsites += modules[i].n;
+
+    Writer w(fd);
+    w.write("CLOUTRC1", 8);
+    w.write(&nsites, sizeof nsites);
+    for (unsigned i = 0; i < m; ++i) {
+      const Module& mod = modules[i];
+      for (uint64_t j = 0; j < mod.n; ++j) {
+	const uint64_t count = mod.counters[j].load(std::memory_order_relaxed);
+	const uint32_t desclen = std::strlen(mod.descs[j]);
+	w.write(&count, sizeof count);
+	w.write(&desclen, sizeof desclen);
+	w.write(mod.descs[j], desclen);
+      }
+    }
+    w.flush();
+    ::close(fd);
+    if (w.ok)
+      ::rename(trace_tmp_file, trace_file);
+    dumping.clear(std::memory_order_release);
+    errno = saved_errno;
+  }
+
+  void dump_text(FILE *f) {
+    std::map<std::string, uint64_t> counts;
+    const unsigned m = num_modules.load(std::memory_order_acquire);
+    for (unsigned i = 0; i < m; ++i)
+      for (uint64_t j = 0; j < modules[i].n; ++j)
+	counts[modules[i].descs[j]] += modules[i].counters[j].load(std::memory_order_relaxed);
+    for (const auto& [s, n] : counts)
+      std::fprintf(f, "%lu %s\n", n, s.c_str());
+  }
+
+  void handle_signal(int) {
+    // Never wait here: the dump in progress may be the one this handler interrupted.
+    dump_binary(false);
+  }
 
   struct Trace {
-    std::map<const char *, unsigned> lfences;
+    Trace() {
+      trace_file = std::getenv("CLOU_TRACE_FILE");
+      if (trace_file == nullptr)
+	return;
+      if (std::snprintf(trace_tmp_file, sizeof trace_tmp_file, "%s.%d.tmp", trace_file, ::getpid()) >=
+	  static_cast<int>(sizeof trace_tmp_file)) {
+	std::fprintf(stderr, "clou_trace: CLOU_TRACE_FILE too long\n");
+	std::abort();
+      }
+
+      struct sigaction sa;
+      std::memset(&sa, 0, sizeof sa);
+      sa.sa_handler = handle_signal;
+      sa.sa_flags = SA_RESTART;
+      sigemptyset(&sa.sa_mask);
+      sigaction(SIGUSR1, &sa, nullptr);
+
+      if (const char *interval_s = std::getenv("CLOU_TRACE_INTERVAL")) {
+	const double interval = std::atof(interval_s);
+	if (interval > 0) {
+	  std::thread([interval] {
+	    while (true) {
+	      std::this_thread::sleep_for(std::chrono::duration<double>(interval));
+	      dump_binary(false);
+	    }
+	  }).detach();
+	}
+      }
+    }
+
     ~Trace() {
-      std::map<std::string, unsigned> counts;
-      for (const auto& [s, n] : lfences)
-	counts[s] += n;
-      for (const auto& [s, n] : counts)
-	std::fprintf(log, "%u %s\n", n, s.c_str());
+      if (trace_file)
+	dump_binary(true);
+      else if (!quiet)
+	dump_text(stderr);
     }
-    
   } trace;
 
 }
 
-extern "C" void clou_trace(const char *s) {
-  trace.lfences[s]++;
+extern "C" void clou_trace_register(uint64_t *counters, const char *const *descs, uint64_t n) {
+  std::scoped_lock lock(register_mutex);
+  const unsigned i = num_modules.load(std::memory_order_relaxed);
+  if (i == max_modules) {
+    std::fprintf(stderr, "clou_trace: too many instrumented modules\n");
+    std::abort();
+  }
+  static_assert(sizeof(std::atomic<uint64_t>) == sizeof(uint64_t) && std::atomic<uint64_t>::is_always_lock_free);
+  modules[i] = Module {.counters = reinterpret_cast<std::atomic<uint64_t> *>(counters), .descs = descs, .n = n};
+  num_modules.store(i + 1, std::memory_order_release);
+}
+
+extern "C" uint64_t clou_trace_num_sites(void) {
+  uint64_t n = 0;
+  const unsigned m = num_modules.load(std::memory_order_acquire);
+  for (unsigned i = 0; i < m; ++i)
+    n += modules[i].n;
+  return n;
+}
+
+/* Copies the counts of the first `n` sites to `counts`. Returns the number of sites. */
+extern "C" uint64_t clou_trace_read(uint64_t *counts, uint64_t n) {
+  uint64_t site = 0;
+  const unsigned m = num_modules.load(std::memory_order_acquire);
+  for (unsigned i = 0; i < m; ++i)
+    for (uint64_t j = 0; j < modules[i].n; ++j, ++site)
+      if (site < n)
+	counts[site] = modules[i].counters[j].load(std::memory_order_relaxed);
+  return site;
+}
+
+extern "C" const char *clou_trace_site_desc(uint64_t site) {
+  const unsigned m = num_modules.load(std::memory_order_acquire);
+  for (unsigned i = 0; i < m; site -= modules[i].n, ++i)
+    if (site < modules[i].n)
+      return modules[i].descs[site];
+  return nullptr;
+}
+
+/* Suppresses the text report at exit, for programs that read the counters themselves. */
+extern "C" void clou_trace_quiet(void) {
+  quiet = true;
 }